@@ -162,6 +162,15 @@ public:
                         const ResponseCallback &responseCallback,
                         const PromptContext    &ctx);
 
+    // Like prompt, but leaves the model's context as it was, for side tasks such as naming a chat. The prompt is
+    // processed on a copy of the context that shares the common prefix and is discarded afterwards. If the copy does
+    // not fit in the context, the response is shortened, or if even the prompt does not fit, this behaves like prompt.
+    // Returns true in that last case, when the model's context was changed after all.
+    virtual bool promptFork(std::string_view        prompt,
+                            const PromptCallback   &promptCallback,
+                            const ResponseCallback &responseCallback,
+                            const PromptContext    &ctx);
+
     virtual int32_t countPromptTokens(std::string_view prompt) const;
 
     virtual size_t embeddingSize() const {
@@ -210,10 +219,13 @@ public:
     virtual int32_t contextLength() const = 0;
     virtual auto specialTokens() -> std::unordered_map<std::string, std::string> const = 0;
 
+    // number of times prompt() ran out of context and discarded tokens, over the lifetime of this model
+    uint64_t contextShiftCount() const { return m_contextShifts; }
+
 protected:
     // These are pure virtual because subclasses need to implement as the default implementation of
     // 'prompt' above calls these functions
-    virtual std::vector<Token> tokenize(std::string_view str) const = 0;
+    virtual std::vector<Token> tokenize(std::string_view str, bool addSpecial) const = 0;
     virtual bool isSpecialToken(Token id) const = 0;
     virtual std::string tokenToString(Token id) const = 0;
     virtual void initSampler(const PromptContext &ctx) = 0;
@@ -227,6 +239,9 @@ protected:
     virtual std::span<const Token> inputTokens() const = 0;
     virtual const std::vector<Token> &endTokens() const = 0;
     virtual bool shouldAddBOS() const = 0;
+    // switch evaluation to a copy of the context, and back, see promptFork
+    virtual void beginFork() = 0;
+    virtual void endFork() = 0;
 
     virtual int32_t maxContextLength(std::string const &modelPath) const
     {
@@ -249,6 +264,10 @@ protected:
     const Implementation *m_implementation = nullptr;
 
     ProgressCallback m_progressCallback;
+    uint64_t m_contextShifts = 0;
+    // the most recent prompt and its tokens, see tokenizePrompt
+    std::string        m_lastPrompt;
+    std::vector<Token> m_lastPromptTokens;
     static bool staticProgressCallback(float progress, void* ctx)
     {
         LLModel* model = static_cast<LLModel*>(ctx);
@@ -257,6 +276,8 @@ protected:
         return true;
     }
 
+    // tokenize a prompt, reusing the tokens of the previous one where possible
+    std::vector<Token> tokenizePrompt(std::string_view prompt);
     // prefill context with prompt
     auto decodePrompt(const PromptCallback &promptCallback,
                       const PromptContext  &promptCtx,
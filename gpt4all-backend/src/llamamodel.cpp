@@ -219,6 +219,8 @@ struct LLamaPrivate {
     std::vector<LLModel::Token>  end_tokens;
     const char                  *backend_name = nullptr;
     std::vector<LLModel::Token>  inputTokens;
+    llama_seq_id                 seqId        = 0; // 1 while prompting a fork
+    std::vector<LLModel::Token>  mainInputTokens; // while prompting a fork
 
     llama_model          *model        = nullptr;
     llama_context        *ctx          = nullptr;
@@ -518,11 +520,11 @@ size_t LLamaModel::restoreState(std::span<const uint8_t> state, std::span<const
     return bytesRead;
 }
 
-std::vector<LLModel::Token> LLamaModel::tokenize(std::string_view str) const
+std::vector<LLModel::Token> LLamaModel::tokenize(std::string_view str, bool addSpecial) const
 {
     std::vector<LLModel::Token> fres(str.length() + 4);
     int32_t fres_len = llama_tokenize(
-        d_ptr->model, str.data(), str.length(), fres.data(), fres.size(), /*add_special*/ true, /*parse_special*/ true
+        d_ptr->model, str.data(), str.length(), fres.data(), fres.size(), addSpecial, /*parse_special*/ true
     );
     fres.resize(fres_len);
     return fres;
@@ -601,7 +603,7 @@ bool LLamaModel::evalTokens(int32_t nPast, std::span<const Token> tokens) const
 {
     assert(!tokens.empty());
 
-    llama_kv_cache_seq_rm(d_ptr->ctx, 0, nPast, -1);
+    llama_kv_cache_seq_rm(d_ptr->ctx, d_ptr->seqId, nPast, -1);
 
     llama_batch batch = llama_batch_init(tokens.size(), 0, 1);
 
@@ -611,7 +613,7 @@ bool LLamaModel::evalTokens(int32_t nPast, std::span<const Token> tokens) const
         batch.token   [i] = tokens[i];
         batch.pos     [i] = nPast + i;
         batch.n_seq_id[i] = 1;
-        batch.seq_id  [i][0] = 0;
+        batch.seq_id  [i][0] = d_ptr->seqId;
         batch.logits  [i] = false;
     }
 
@@ -626,6 +628,7 @@ bool LLamaModel::evalTokens(int32_t nPast, std::span<const Token> tokens) const
 void LLamaModel::shiftContext(const PromptContext &promptCtx, int32_t *nPast)
 {
     // infinite text generation via context shifting
+    assert(d_ptr->seqId == 0); // promptFork never runs out of context
 
     // erase up to n_ctx*contextErase tokens
     int n_keep = shouldAddBOS();
@@ -713,6 +716,25 @@ bool LLamaModel::shouldAddBOS() const
     return llama_add_bos_token(d_ptr->model);
 }
 
+// The fork is a second sequence in the KV cache. Copying a sequence only tags the existing cells with the new sequence
+// id, so the cells of the common prefix are shared and nothing is copied.
+void LLamaModel::beginFork()
+{
+    assert(d_ptr->seqId == 0);
+    llama_kv_cache_seq_cp(d_ptr->ctx, 0, 1, -1, -1);
+    d_ptr->mainInputTokens = d_ptr->inputTokens;
+    d_ptr->seqId = 1;
+}
+
+void LLamaModel::endFork()
+{
+    assert(d_ptr->seqId == 1);
+    llama_kv_cache_seq_rm(d_ptr->ctx, 1, -1, -1);
+    d_ptr->inputTokens = std::move(d_ptr->mainInputTokens);
+    d_ptr->mainInputTokens.clear();
+    d_ptr->seqId = 0;
+}
+
 int32_t LLamaModel::maxContextLength(std::string const &modelPath) const
 {
     return get_arch_key_u32(modelPath, "context_length");
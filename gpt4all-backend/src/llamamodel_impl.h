@@ -53,7 +53,7 @@ public:
     auto specialTokens() -> std::unordered_map<std::string, std::string> const override;
 
 protected:
-    std::vector<Token> tokenize(std::string_view str) const override;
+    std::vector<Token> tokenize(std::string_view str, bool addSpecial) const override;
     bool isSpecialToken(Token id) const override;
     std::string tokenToString(Token id) const override;
     void initSampler(const PromptContext &ctx) override;
@@ -67,6 +67,8 @@ protected:
     std::span<const Token> inputTokens() const override;
     const std::vector<Token> &endTokens() const override;
     bool shouldAddBOS() const override;
+    void beginFork() override;
+    void endFork() override;
     int32_t maxContextLength(std::string const &modelPath) const override;
     int32_t layerCount(std::string const &modelPath) const override;
     auto chatTemplate(const char *modelPath) const -> std::expected<std::string, std::string> override;
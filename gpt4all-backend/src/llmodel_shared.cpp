@@ -31,7 +31,7 @@ void LLModel::prompt(
     if (!promptCtx.n_predict)
         return; // nothing requested
 
-    auto embd_inp = tokenize(prompt);
+    auto embd_inp = tokenizePrompt(prompt);
     if (embd_inp.empty())
         throw std::invalid_argument("Prompt tokenized to zero tokens.");
 
@@ -39,11 +39,102 @@ void LLModel::prompt(
         generateResponse(responseCallback, promptCtx, /*n_past*/ *res);
 }
 
+bool LLModel::promptFork(
+    std::string_view        prompt,
+    const PromptCallback   &promptCallback,
+    const ResponseCallback &responseCallback,
+    const PromptContext    &promptCtx
+) {
+    if (!isModelLoaded())
+        throw std::invalid_argument("Attempted to prompt an unloaded model.");
+    if (!supportsCompletion())
+        throw std::invalid_argument("Not a text completion model.");
+    if (!promptCtx.n_batch)
+        throw std::invalid_argument("Batch size cannot be zero.");
+    if (!promptCtx.n_predict)
+        return false; // nothing requested
+
+    // not tokenizePrompt, so the next call to prompt can still reuse the tokens of the previous one
+    auto embd_inp = tokenize(prompt, /*addSpecial*/ true);
+    if (embd_inp.empty())
+        throw std::invalid_argument("Prompt tokenized to zero tokens.");
+
+    // The fork shares the KV cells of the common prefix with the context, which keeps all of its cells. Everything
+    // the fork decodes past that prefix needs cells of its own, and it must not shift the context.
+    int32_t n_batch = std::min(promptCtx.n_batch, LLMODEL_MAX_PROMPT_BATCH);
+    int32_t nShared = computeModelInputPosition(embd_inp);
+    nShared -= std::min(n_batch, nShared); // see decodePrompt
+    int32_t forkEnd = contextLength() - (inputLength() - nShared);
+    int32_t maxPredict = forkEnd - int32_t(embd_inp.size()) - 1;
+
+    if (maxPredict < 1) {
+        // not enough room; use the context itself
+        if (auto res = decodePrompt(promptCallback, promptCtx, std::move(embd_inp)))
+            generateResponse(responseCallback, promptCtx, /*n_past*/ *res);
+        return true;
+    }
+
+    PromptContext forkCtx = promptCtx;
+    forkCtx.n_predict = std::min(promptCtx.n_predict, maxPredict);
+
+    beginFork();
+    try {
+        if (auto res = decodePrompt(promptCallback, forkCtx, std::move(embd_inp)))
+            generateResponse(responseCallback, forkCtx, /*n_past*/ *res);
+    } catch (...) {
+        endFork();
+        throw;
+    }
+    endFork();
+    return false;
+}
+
 int32_t LLModel::countPromptTokens(std::string_view prompt) const
 {
     if (!isModelLoaded())
         throw std::invalid_argument("Attempted to tokenize with an unloaded model.");
-    return int32_t(tokenize(prompt).size());
+    return int32_t(tokenize(prompt, /*addSpecial*/ true).size());
+}
+
+// Chat prompts are re-rendered from the start of the conversation every turn, so most of each prompt is the same text
+// as the previous one. llama.cpp splits the text at special tokens before tokenizing the pieces in between, which
+// means the tokens before a special token do not depend on anything after it. So the tokens of the previous prompt
+// before its last special token within the common prefix are reused, and only the rest is tokenized.
+auto LLModel::tokenizePrompt(std::string_view prompt) -> std::vector<Token>
+{
+    size_t common = ranges::mismatch(prompt, m_lastPrompt).in1 - prompt.begin();
+
+    std::vector<Token> tokens;
+    std::optional<size_t> reusedTextLength;
+    size_t searchEnd = m_lastPrompt.size();
+    // the BOS token added by the tokenizer does not appear in the text
+    for (auto i = ptrdiff_t(m_lastPromptTokens.size()) - 1; i >= ptrdiff_t(shouldAddBOS()) && searchEnd > 0; i--) {
+        Token tok = m_lastPromptTokens[i];
+        if (!isSpecialToken(tok))
+            continue;
+        auto piece = tokenToString(tok);
+        size_t pos = m_lastPrompt.rfind(piece, searchEnd - 1);
+        if (pos == std::string::npos)
+            break; // should not happen; tokenize everything
+        if (pos + piece.size() <= common) {
+            tokens.assign(m_lastPromptTokens.begin(), m_lastPromptTokens.begin() + i);
+            reusedTextLength = pos;
+            break;
+        }
+        searchEnd = pos;
+    }
+
+    if (reusedTextLength) {
+        auto rest = tokenize(prompt.substr(*reusedTextLength), /*addSpecial*/ false);
+        tokens.insert(tokens.end(), rest.begin(), rest.end());
+        assert(tokens == tokenize(prompt, /*addSpecial*/ true));
+    } else {
+        tokens = tokenize(prompt, /*addSpecial*/ true);
+    }
+
+    m_lastPrompt.assign(prompt);
+    m_lastPromptTokens = tokens;
+    return tokens;
 }
 
 auto LLModel::decodePrompt(
@@ -80,6 +171,7 @@ auto LLModel::decodePrompt(
 
         // erase nDiscard tokens
         embd_inp.erase(discardedTokens.begin(), discardedTokens.end());
+        m_contextShifts++;
         assert(int32_t(embd_inp.size()) <= nCtx);
 
         // check the cache again, just in case
@@ -101,6 +193,7 @@ auto LLModel::decodePrompt(
         // Check if the context has run out...
         if (nPast + int32_t(batch.size()) > nCtx) {
             shiftContext(promptCtx, &nPast);
+            m_contextShifts++;
             assert(nPast + int32_t(batch.size()) <= nCtx);
         }
 
@@ -167,6 +260,7 @@ void LLModel::generateResponse(
             // Shift context if out of space
             if (nPast >= contextLength()) {
                 shiftContext(promptCtx, &nPast);
+                m_contextShifts++;
                 assert(nPast < contextLength());
             }
 
@@ -486,16 +486,67 @@ MySettingsTab {
             Accessible.name: nThreadsLabel.text
             Accessible.description: ToolTip.text
         }
+        MySettingsLabel {
+            id: saveContextLabel
+            text: qsTr("Save Chat Context")
+            helpText: qsTr("Save the model's state for each chat to disk, so that continuing a long chat does not have to process the whole conversation again.")
+            Layout.row: 12
+            Layout.column: 0
+        }
+        MyCheckBox {
+            id: saveContextBox
+            Layout.row: 12
+            Layout.column: 2
+            Layout.alignment: Qt.AlignRight
+            checked: MySettings.chatSaveContext
+            onClicked: {
+                MySettings.chatSaveContext = !MySettings.chatSaveContext
+            }
+        }
+        MySettingsLabel {
+            id: saveContextSizeLabel
+            text: qsTr("Saved Chat Context Size Limit (MB)")
+            helpText: qsTr("The model's state is not saved for a chat if it would be larger than this.")
+            Layout.row: 13
+            Layout.column: 0
+        }
+        MyTextField {
+            id: saveContextSizeField
+            text: MySettings.chatSaveContextSize
+            color: theme.textColor
+            font.pixelSize: theme.fontSizeLarge
+            Layout.row: 13
+            Layout.column: 2
+            Layout.minimumWidth: 200
+            Layout.maximumWidth: 200
+            Layout.alignment: Qt.AlignRight
+            enabled: MySettings.chatSaveContext
+            validator: IntValidator {
+                bottom: 1
+            }
+            onEditingFinished: {
+                var val = parseInt(text)
+                if (!isNaN(val)) {
+                    MySettings.chatSaveContextSize = val
+                    focus = false
+                } else {
+                    text = MySettings.chatSaveContextSize
+                }
+            }
+            Accessible.role: Accessible.EditableText
+            Accessible.name: saveContextSizeLabel.text
+            Accessible.description: saveContextSizeLabel.helpText
+        }
         MySettingsLabel {
             id: trayLabel
             text: qsTr("Enable System Tray")
             helpText: qsTr("The application will minimize to the system tray when the window is closed.")
-            Layout.row: 13
+            Layout.row: 14
             Layout.column: 0
         }
         MyCheckBox {
             id: trayBox
-            Layout.row: 13
+            Layout.row: 14
             Layout.column: 2
             Layout.alignment: Qt.AlignRight
             checked: MySettings.systemTray
@@ -507,12 +558,12 @@ MySettingsTab {
             id: serverChatLabel
             text: qsTr("Enable Local API Server")
             helpText: qsTr("Expose an OpenAI-Compatible server to localhost. WARNING: Results in increased resource usage.")
-            Layout.row: 14
+            Layout.row: 15
             Layout.column: 0
         }
         MyCheckBox {
             id: serverChatBox
-            Layout.row: 14
+            Layout.row: 15
             Layout.column: 2
             Layout.alignment: Qt.AlignRight
             checked: MySettings.serverChat
@@ -524,7 +575,7 @@ MySettingsTab {
             id: serverPortLabel
             text: qsTr("API Server Port")
             helpText: qsTr("The port to use for the local server. Requires restart.")
-            Layout.row: 15
+            Layout.row: 16
             Layout.column: 0
         }
         MyTextField {
@@ -532,7 +583,7 @@ MySettingsTab {
             text: MySettings.networkPort
             color: theme.textColor
             font.pixelSize: theme.fontSizeLarge
-            Layout.row: 15
+            Layout.row: 16
             Layout.column: 2
             Layout.minimumWidth: 200
             Layout.maximumWidth: 200
@@ -553,6 +604,74 @@ MySettingsTab {
             Accessible.name: serverPortLabel.text
             Accessible.description: serverPortLabel.helpText
         }
+        MySettingsLabel {
+            id: serverMirrorChatLabel
+            text: qsTr("Show API Requests in Server Chat")
+            helpText: qsTr("Copy each finished API request and its response into the Server Chat. Disable for lower overhead on busy servers.")
+            Layout.row: 17
+            Layout.column: 0
+        }
+        MyCheckBox {
+            id: serverMirrorChatBox
+            Layout.row: 17
+            Layout.column: 2
+            Layout.alignment: Qt.AlignRight
+            checked: MySettings.serverMirrorChat
+            onClicked: {
+                MySettings.serverMirrorChat = !MySettings.serverMirrorChat
+            }
+        }
+        MySettingsLabel {
+            id: serverResponseCacheLabel
+            text: qsTr("Cache API Responses")
+            helpText: qsTr("Answer repeated API requests with temperature 0 from a cache on disk instead of running the model again.")
+            Layout.row: 18
+            Layout.column: 0
+        }
+        MyCheckBox {
+            id: serverResponseCacheBox
+            Layout.row: 18
+            Layout.column: 2
+            Layout.alignment: Qt.AlignRight
+            checked: MySettings.serverResponseCache
+            onClicked: {
+                MySettings.serverResponseCache = !MySettings.serverResponseCache
+            }
+        }
+        MySettingsLabel {
+            id: serverResponseCacheSizeLabel
+            text: qsTr("API Response Cache Size (MB)")
+            helpText: qsTr("The maximum disk space used by cached API responses.")
+            Layout.row: 19
+            Layout.column: 0
+        }
+        MyTextField {
+            id: serverResponseCacheSizeField
+            text: MySettings.serverResponseCacheSize
+            color: theme.textColor
+            font.pixelSize: theme.fontSizeLarge
+            Layout.row: 19
+            Layout.column: 2
+            Layout.minimumWidth: 200
+            Layout.maximumWidth: 200
+            Layout.alignment: Qt.AlignRight
+            enabled: MySettings.serverResponseCache
+            validator: IntValidator {
+                bottom: 1
+            }
+            onEditingFinished: {
+                var val = parseInt(text)
+                if (!isNaN(val)) {
+                    MySettings.serverResponseCacheSize = val
+                    focus = false
+                } else {
+                    text = MySettings.serverResponseCacheSize
+                }
+            }
+            Accessible.role: Accessible.EditableText
+            Accessible.name: serverResponseCacheSizeLabel.text
+            Accessible.description: serverResponseCacheSizeLabel.helpText
+        }
 
         /*MySettingsLabel {
             id: gpuOverrideLabel
@@ -577,12 +696,12 @@ MySettingsTab {
             id: updatesLabel
             text: qsTr("Check For Updates")
             helpText: qsTr("Manually check for an update to GPT4All.");
-            Layout.row: 16
+            Layout.row: 20
             Layout.column: 0
         }
 
         MySettingsButton {
-            Layout.row: 16
+            Layout.row: 20
             Layout.column: 2
             Layout.alignment: Qt.AlignRight
             text: qsTr("Updates");
@@ -593,7 +712,7 @@ MySettingsTab {
         }
 
         Rectangle {
-            Layout.row: 17
+            Layout.row: 21
             Layout.column: 0
             Layout.columnSpan: 3
             Layout.fillWidth: true
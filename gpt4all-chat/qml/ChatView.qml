@@ -25,6 +25,11 @@ Rectangle {
     property var currentChat: ChatListModel.currentChat
     property var chatModel: currentChat.chatModel
     property var currentModelInfo: currentChat && currentChat.modelInfo
+
+    onCurrentChatChanged: {
+        if (currentChat && currentChat.contentLoadError !== "")
+            contentLoadErrorPopup.open()
+    }
     property var currentModelId: null
     onCurrentModelInfoChanged: {
         const newId = currentModelInfo && currentModelInfo.id;
@@ -46,6 +51,10 @@ Rectangle {
             if (currentChat.modelLoadingError !== "")
                 modelLoadingErrorPopup.open()
         }
+        function onContentLoadErrorChanged() {
+            if (currentChat.contentLoadError !== "")
+                contentLoadErrorPopup.open()
+        }
         function onModelLoadingWarning(warning) {
             modelLoadingWarningPopup.open_(warning)
         }
@@ -77,6 +86,13 @@ Rectangle {
               + "<li>Check out our <a href=\"https://discord.gg/4M2QFmTt2k\">discord channel</a> for help").arg(currentChat.modelLoadingError);
     }
 
+    PopupDialog {
+        id: contentLoadErrorPopup
+        anchors.centerIn: parent
+        shouldTimeOut: false
+        text: qsTr("<h3>Encountered an error loading chat:</h3><br><i>\"%1\"</i>").arg(currentChat.contentLoadError)
+    }
+
     PopupDialog {
         id: modelLoadingWarningPopup
         property string message
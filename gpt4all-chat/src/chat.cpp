@@ -9,14 +9,20 @@
 
 #include <QBuffer>
 #include <QDataStream>
+#include <QDateTime>
 #include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QIODevice>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonValue>
 #include <QLatin1String>
 #include <QMap>
+#include <QMutexLocker>
 #include <QRegularExpression>
 #include <QString>
+#include <QThreadPool>
 #include <QVariant>
 #include <Qt>
 #include <QtLogging>
@@ -76,11 +82,20 @@ void Chat::connectLLM()
     connect(m_llmodel, &ChatLLM::modelInfoChanged, this, &Chat::handleModelChanged, Qt::QueuedConnection);
     connect(m_llmodel, &ChatLLM::trySwitchContextOfLoadedModelCompleted, this, &Chat::handleTrySwitchContextOfLoadedModelCompleted, Qt::QueuedConnection);
 
+    // direct, so that a chat name or follow-up questions being generated on the ChatLLM thread can give way to it
+    connect(this, &Chat::promptRequested, m_llmodel, &ChatLLM::setPromptPending, Qt::DirectConnection);
+    connect(this, &Chat::regenerateResponseRequested, m_llmodel, &ChatLLM::setPromptPending, Qt::DirectConnection);
     connect(this, &Chat::promptRequested, m_llmodel, &ChatLLM::prompt, Qt::QueuedConnection);
     connect(this, &Chat::modelChangeRequested, m_llmodel, &ChatLLM::modelChangeRequested, Qt::QueuedConnection);
     connect(this, &Chat::loadDefaultModelRequested, m_llmodel, &ChatLLM::loadDefaultModel, Qt::QueuedConnection);
     connect(this, &Chat::generateNameRequested, m_llmodel, &ChatLLM::generateName, Qt::QueuedConnection);
     connect(this, &Chat::regenerateResponseRequested, m_llmodel, &ChatLLM::regenerateResponse, Qt::QueuedConnection);
+    // after the requests above are posted
+    connect(this, &Chat::promptRequested, m_llmodel, &ChatLLM::wake, Qt::DirectConnection);
+    connect(this, &Chat::modelChangeRequested, m_llmodel, &ChatLLM::wake, Qt::DirectConnection);
+    connect(this, &Chat::loadDefaultModelRequested, m_llmodel, &ChatLLM::wake, Qt::DirectConnection);
+    connect(this, &Chat::generateNameRequested, m_llmodel, &ChatLLM::wake, Qt::DirectConnection);
+    connect(this, &Chat::regenerateResponseRequested, m_llmodel, &ChatLLM::wake, Qt::DirectConnection);
 
     connect(this, &Chat::collectionListChanged, m_collectionModel, &LocalDocsCollectionsModel::setCollections);
 
@@ -100,6 +115,7 @@ void Chat::reset()
     // further down in the list. This might surprise the user. In the future, we might get rid of
     // the "reset context" button in the UI.
     m_chatModel->clear();
+    m_journal.invalidate(); // there is no file with the new id yet
     m_needsSave = true;
 }
 
@@ -146,6 +162,7 @@ void Chat::newPromptResponsePair(const QString &prompt, const QList<QUrl> &attac
             continue;
         }
 
+        attached.process();
         attachments << attached;
         attachedContexts << attached.processedContent();
     }
@@ -459,8 +476,11 @@ void Chat::handleTrySwitchContextOfLoadedModelCompleted(int value)
     emit trySwitchContextInProgressChanged();
 }
 
-bool Chat::serialize(QDataStream &stream, int version) const
+QByteArray Chat::serializeHeader(int version) const
 {
+    QByteArray header;
+    QDataStream stream(&header, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_6_2);
     stream << m_creationDate;
     stream << m_id;
     stream << m_name;
@@ -471,6 +491,16 @@ bool Chat::serialize(QDataStream &stream, int version) const
         stream << m_modelInfo.filename();
     if (version >= 3)
         stream << m_collections;
+    return header;
+}
+
+bool Chat::serialize(QDataStream &stream, int version) const
+{
+    Q_ASSERT(stream.version() == QDataStream::Qt_6_2); // see serializeHeader
+    if (!m_contentLoadError.isEmpty())
+        return false; // see loadContent
+    m_serializedHeader = serializeHeader(version);
+    stream.writeRawData(m_serializedHeader.constData(), m_serializedHeader.size());
 
     if (!m_llmodel->serialize(stream, version))
         return false;
@@ -480,6 +510,11 @@ bool Chat::serialize(QDataStream &stream, int version) const
 }
 
 bool Chat::deserialize(QDataStream &stream, int version)
+{
+    return deserializeHeader(stream, version) && deserializeContent(stream, version);
+}
+
+bool Chat::deserializeHeader(QDataStream &stream, int version)
 {
     stream >> m_creationDate;
     stream >> m_id;
@@ -507,6 +542,12 @@ bool Chat::deserialize(QDataStream &stream, int version)
     }
 
     m_llmodel->setModelInfo(m_modelInfo);
+    m_needsSave = false;
+    return stream.status() == QDataStream::Ok;
+}
+
+bool Chat::deserializeContent(QDataStream &stream, int version)
+{
     if (!m_llmodel->deserialize(stream, version))
         return false;
     if (!m_chatModel->deserialize(stream, version))
@@ -520,6 +561,102 @@ bool Chat::deserialize(QDataStream &stream, int version)
     return true;
 }
 
+void Chat::DeferredContent::fetch()
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly) || !file.seek(offset)) {
+        qWarning() << "ERROR: Couldn't read chat from file:" << filePath << file.errorString();
+    } else {
+        data = file.readAll();
+        read = true;
+        QFileInfo info(file);
+        fileSize     = info.size();
+        fileModified = info.lastModified().toMSecsSinceEpoch();
+    }
+
+    QFile journalFile(ChatJournal::path(filePath));
+    if (journalFile.open(QIODevice::ReadOnly))
+        journal = journalFile.readAll();
+    fetched = true;
+}
+
+void Chat::deferContent(const QString &filePath, qint64 offset, int version)
+{
+    m_deferredContent = std::make_shared<DeferredContent>();
+    m_deferredContent->filePath = filePath;
+    m_deferredContent->offset   = offset;
+    m_deferredContent->version  = version;
+}
+
+void Chat::loadContent()
+{
+    if (!m_deferredContent)
+        return;
+
+    auto content = m_deferredContent;
+    QMutexLocker locker(&content->mutex); // wait for a prefetch in progress
+    if (!content->fetched)
+        content->fetch();
+
+    qDebug() << "deserializing chat" << content->filePath;
+    QDataStream in(content->data);
+    if (content->version < 2)
+        in.setVersion(QDataStream::Qt_6_2);
+    if (!content->read || !deserializeContent(in, content->version)) {
+        qWarning() << "ERROR: Couldn't deserialize chat from file:" << content->filePath;
+        /* Writing the chat now would replace the file with whatever could be read, so keep the content deferred,
+         * to be read again the next time the chat is opened, and refuse to save until then. */
+        m_chatModel->clear();
+        content->fetched = false;
+        content->read    = false;
+        content->data.clear();
+        content->journal.clear();
+        m_contentLoadError = tr("Couldn't read this chat from %1. The file is left as it is, and the chat is not "
+                                "saved until it can be read.").arg(content->filePath);
+        emit contentLoadErrorChanged();
+        return;
+    }
+    m_deferredContent.reset();
+    if (!m_contentLoadError.isEmpty()) {
+        m_contentLoadError.clear();
+        emit contentLoadErrorChanged();
+    }
+    if (!in.atEnd())
+        qWarning().nospace() << "error loading chat from " << content->filePath << ": extra data at end of file";
+
+    m_journal.reset(content->version, serializeHeader(content->version));
+    if (!content->journal.isEmpty()) {
+        m_journal.apply(content->filePath, content->journal, content->fileSize, content->fileModified,
+                        [this, version = content->version](QDataStream &in) {
+            return m_chatModel->deserializeChanges(in, version);
+        });
+    }
+}
+
+bool Chat::appendToJournal(const QString &chatFilePath, int version)
+{
+    return m_journal.append(chatFilePath, version, serializeHeader(version), [&](QDataStream &out) {
+        m_chatModel->serializeChanges(out, version);
+    });
+}
+
+void Chat::markSaved(int version)
+{
+    m_journal.reset(version, m_serializedHeader);
+}
+
+void Chat::prefetchContent()
+{
+    if (!m_deferredContent)
+        return;
+
+    QThreadPool::globalInstance()->start([content = m_deferredContent] {
+        QMutexLocker locker(&content->mutex);
+        if (!content->fetched)
+            content->fetch();
+    });
+}
+
 QList<QString> Chat::collectionList() const
 {
     return m_collections;
@@ -1,14 +1,17 @@
 #ifndef CHAT_H
 #define CHAT_H
 
+#include "chatjournal.h"
 #include "chatllm.h"
 #include "chatmodel.h"
 #include "database.h" // IWYU pragma: keep
 #include "localdocsmodel.h" // IWYU pragma: keep
 #include "modellist.h"
 
+#include <QByteArray>
 #include <QDateTime>
 #include <QList>
+#include <QMutex>
 #include <QObject>
 #include <QQmlEngine>
 #include <QString>
@@ -16,6 +19,8 @@
 #include <QStringView>
 #include <QtGlobal>
 
+#include <memory>
+
 class QDataStream;
 
 class Chat : public QObject
@@ -33,6 +38,7 @@ class Chat : public QObject
     Q_PROPERTY(ResponseState responseState READ responseState NOTIFY responseStateChanged)
     Q_PROPERTY(QList<QString> collectionList READ collectionList NOTIFY collectionListChanged)
     Q_PROPERTY(QString modelLoadingError READ modelLoadingError NOTIFY modelLoadingErrorChanged)
+    Q_PROPERTY(QString contentLoadError READ contentLoadError NOTIFY contentLoadErrorChanged)
     Q_PROPERTY(QString tokenSpeed READ tokenSpeed NOTIFY tokenSpeedChanged)
     Q_PROPERTY(QString deviceBackend READ deviceBackend NOTIFY loadedModelInfoChanged)
     Q_PROPERTY(QString device READ device NOTIFY loadedModelInfoChanged)
@@ -70,13 +76,14 @@ public:
     QString name() const { return m_userName.isEmpty() ? m_name : m_userName; }
     void setName(const QString &name)
     {
+        loadContent(); // about to be saved
         m_userName = name;
         emit nameChanged();
         m_needsSave = true;
     }
     ChatModel *chatModel() { return m_chatModel; }
 
-    bool isNewChat() const { return m_name == tr("New Chat") && !m_chatModel->count(); }
+    bool isNewChat() const { return isContentLoaded() && m_name == tr("New Chat") && !m_chatModel->count(); }
 
     Q_INVOKABLE void reset();
     bool  isModelLoaded()          const { return m_modelLoadingPercentage == 1.0f; }
@@ -105,6 +112,27 @@ public:
     QDateTime creationDate() const { return QDateTime::fromSecsSinceEpoch(m_creationDate); }
     bool serialize(QDataStream &stream, int version) const;
     bool deserialize(QDataStream &stream, int version);
+    // The header is what the chat list shows: the creation date, id, name, model and collections. The content is
+    // everything else, mainly the messages.
+    bool deserializeHeader(QDataStream &stream, int version);
+    bool deserializeContent(QDataStream &stream, int version);
+
+    // Restored chats only read their header at startup. The content is read from the chat file, starting at offset,
+    // when the chat is opened or renamed.
+    void deferContent(const QString &filePath, qint64 offset, int version);
+    bool isContentLoaded() const { return !m_deferredContent; }
+    void loadContent();
+    // reads the deferred content on the global thread pool, so that opening the chat later does not wait for the disk
+    void prefetchContent();
+
+    // Once a chat file has been read or written, saving a chat appends the messages that changed since the last save
+    // to a journal next to the chat file, see ChatJournal. The whole chat file is written again, and the journal
+    // removed, when the header changed or the journal has grown larger than the chat file.
+    // Returns false without changing the journal if the whole chat file has to be written instead.
+    bool appendToJournal(const QString &chatFilePath, int version);
+    // called by ChatSaver after writing the whole chat file with serialize and removing its journal
+    void markSaved(int version);
+    void markSaveFailed() { m_journal.invalidate(); }
     bool isServer() const { return m_isServer; }
 
     QList<QString> collectionList() const;
@@ -115,6 +143,8 @@ public:
     Q_INVOKABLE void removeCollection(const QString &collection);
 
     QString modelLoadingError() const { return m_modelLoadingError; }
+    // set while the messages of the chat file cannot be read; the chat is not saved until they can
+    QString contentLoadError() const { return m_contentLoadError; }
 
     QString tokenSpeed() const { return m_tokenSpeed; }
     QString deviceBackend() const;
@@ -126,7 +156,7 @@ public:
 
     QList<QString> generatedQuestions() const { return m_generatedQuestions; }
 
-    bool needsSave() const { return m_needsSave; }
+    bool needsSave() const { return m_needsSave && m_contentLoadError.isEmpty(); }
     void setNeedsSave(bool n) { m_needsSave = n; }
 
 public Q_SLOTS:
@@ -151,6 +181,7 @@ Q_SIGNALS:
     void loadDefaultModelRequested();
     void generateNameRequested();
     void modelLoadingErrorChanged();
+    void contentLoadErrorChanged();
     void isServerChanged();
     void collectionListChanged(const QList<QString> &collectionList);
     void tokenSpeedChanged();
@@ -180,12 +211,30 @@ private Q_SLOTS:
     void handleTrySwitchContextOfLoadedModelCompleted(int value);
 
 private:
+    struct DeferredContent {
+        QString    filePath;
+        qint64     offset;
+        int        version;
+        QMutex     mutex;
+        QByteArray data;
+        QByteArray journal;
+        qint64     fileSize     = 0;
+        qint64     fileModified = 0; // ms since epoch
+        bool       fetched = false;
+        bool       read    = false; // whether the chat file could be read
+
+        void fetch(); // call with the mutex held
+    };
+
+    QByteArray serializeHeader(int version) const;
+
     QString m_id;
     QString m_name;
     QString m_generatedName;
     QString m_userName;
     ModelInfo m_modelInfo;
     QString m_modelLoadingError;
+    QString m_contentLoadError;
     QString m_tokenSpeed;
     QString m_device;
     QString m_fallbackReason;
@@ -209,6 +258,9 @@ private:
     // - The chat was changed after loading it from disk.
     bool m_needsSave = true;
     int m_consecutiveToolCalls = 0;
+    std::shared_ptr<DeferredContent> m_deferredContent;
+    ChatJournal m_journal; // the state of the chat file and its journal as of the last load or save
+    mutable QByteArray m_serializedHeader; // written by the last call to serialize
 };
 
 #endif // CHAT_H
@@ -72,6 +72,13 @@ public:
                 const ResponseCallback &responseCallback,
                 const PromptContext    &ctx) override;
 
+    // there is no local context to preserve
+    bool promptFork(std::string_view        prompt,
+                    const PromptCallback   &promptCallback,
+                    const ResponseCallback &responseCallback,
+                    const PromptContext    &ctx) override
+    { this->prompt(prompt, promptCallback, responseCallback, ctx); return false; }
+
     [[noreturn]]
     int32_t countPromptTokens(std::string_view prompt) const override
     { Q_UNUSED(prompt); throwNotImplemented(); }
@@ -105,8 +112,8 @@ protected:
     static void throwNotImplemented() { throw std::logic_error("not implemented"); }
 
     [[noreturn]]
-    std::vector<Token> tokenize(std::string_view str) const override
-    { Q_UNUSED(str); throwNotImplemented(); }
+    std::vector<Token> tokenize(std::string_view str, bool addSpecial) const override
+    { Q_UNUSED(str); Q_UNUSED(addSpecial); throwNotImplemented(); }
 
     [[noreturn]]
     bool isSpecialToken(Token id) const override
@@ -156,6 +163,14 @@ protected:
     bool shouldAddBOS() const override
     { throwNotImplemented(); }
 
+    [[noreturn]]
+    void beginFork() override
+    { throwNotImplemented(); }
+
+    [[noreturn]]
+    void endFork() override
+    { throwNotImplemented(); }
+
     [[noreturn]]
     std::span<const Token> inputTokens() const override
     { throwNotImplemented(); }
@@ -0,0 +1,101 @@
+#include "chatjournal.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QIODevice>
+#include <QtLogging>
+
+#include <algorithm>
+
+static constexpr quint32 CHAT_JOURNAL_MAGIC = 0x4A9E3B51;
+// journals smaller than this are not compacted, even if the chat file is smaller
+static constexpr qint64 CHAT_JOURNAL_MIN_COMPACT_SIZE = 64 * 1024;
+
+void ChatJournal::reset(int version, const QByteArray &header)
+{
+    m_version = version;
+    m_header  = header;
+    m_size    = 0;
+}
+
+void ChatJournal::apply(const QString &chatFilePath, const QByteArray &journal, qint64 fileSize, qint64 fileModified,
+                        const std::function<bool(QDataStream &)> &applyRecord)
+{
+    QDataStream in(journal);
+    quint32 magic;
+    qint32 version;
+    qint64 journalFileSize, journalFileModified;
+    in >> magic >> version >> journalFileSize >> journalFileModified;
+    if (in.status() != QDataStream::Ok || magic != CHAT_JOURNAL_MAGIC || version != m_version) {
+        qWarning() << "WARNING: ignoring chat journal with unknown format:" << path(chatFilePath);
+        return;
+    }
+    if (journalFileSize != fileSize || journalFileModified != fileModified) {
+        // the chat file was written again, but the journal could not be removed
+        qWarning() << "WARNING: ignoring stale chat journal:" << path(chatFilePath);
+        return;
+    }
+    in.setVersion(QDataStream::Qt_6_2);
+
+    qint64 validSize = in.device()->pos();
+    while (!in.atEnd()) {
+        QByteArray record;
+        in >> record;
+        if (in.status() != QDataStream::Ok) {
+            qWarning() << "WARNING: ignoring incomplete record at the end of chat journal:" << path(chatFilePath);
+            break;
+        }
+        QDataStream recordIn(record);
+        recordIn.setVersion(QDataStream::Qt_6_2);
+        if (!applyRecord(recordIn)) {
+            qWarning() << "ERROR: Couldn't apply chat journal:" << path(chatFilePath);
+            break;
+        }
+        validSize = in.device()->pos();
+    }
+    // if this is less than the size of the file, the next save writes the whole chat file instead of appending
+    m_size = validSize;
+}
+
+bool ChatJournal::append(const QString &chatFilePath, int version, const QByteArray &header,
+                         const std::function<void(QDataStream &)> &writeRecord)
+{
+    if (m_version != version || header != m_header)
+        return false;
+
+    const QFileInfo fileInfo(chatFilePath);
+    const QString journalPath = path(chatFilePath);
+    if (!fileInfo.exists() || QFileInfo(journalPath).size() != m_size)
+        return false; // not what we saved
+
+    QByteArray record;
+    {
+        QDataStream out(&record, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_6_2);
+        writeRecord(out);
+    }
+    // compact once the journal would outgrow the chat file
+    if (m_size + record.size() > std::max(fileInfo.size(), CHAT_JOURNAL_MIN_COMPACT_SIZE))
+        return false;
+
+    QFile journal(journalPath);
+    if (!journal.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qWarning() << "ERROR: Couldn't open chat journal:" << journalPath << journal.errorString();
+        return false;
+    }
+    QDataStream out(&journal);
+    if (!m_size)
+        out << CHAT_JOURNAL_MAGIC << qint32(version) << fileInfo.size() << fileInfo.lastModified().toMSecsSinceEpoch();
+    out.setVersion(QDataStream::Qt_6_2);
+    out << record;
+    if (out.status() != QDataStream::Ok || !journal.flush()) {
+        qWarning() << "ERROR: Couldn't append to chat journal:" << journalPath << journal.errorString();
+        return false; // the chat file is written instead, which replaces the journal
+    }
+
+    m_size = journal.size();
+    return true;
+}
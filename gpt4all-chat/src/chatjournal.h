@@ -0,0 +1,47 @@
+#ifndef CHATJOURNAL_H
+#define CHATJOURNAL_H
+
+#include <QByteArray>
+#include <QString>
+#include <QtGlobal>
+
+#include <functional>
+
+class QDataStream;
+
+using namespace Qt::Literals::StringLiterals;
+
+// The journal next to a chat file. Once the chat file has been read or written, saving the chat appends a record of
+// the messages that changed since the last save, and loading the chat applies the records after reading the chat file.
+// The records are written and read by the caller; this only keeps track of whether they can still be appended.
+class ChatJournal
+{
+public:
+    static QString path(const QString &chatFilePath) { return chatFilePath + u".journal"_s; }
+
+    // Call after reading or writing the whole chat file, with the version and header it has.
+    void reset(int version, const QByteArray &header);
+    // There is no chat file to append to, so the next save has to write one.
+    void invalidate() { m_version = 0; }
+
+    // Calls applyRecord for each record of a journal that was read along with the chat file, given the size and
+    // modification time (ms since epoch) of the chat file. A journal from before the chat file was last written is
+    // ignored, as are the records after one that cannot be read or applied.
+    void apply(const QString &chatFilePath, const QByteArray &journal, qint64 fileSize, qint64 fileModified,
+               const std::function<bool(QDataStream &)> &applyRecord);
+
+    // Appends the record written by writeRecord. Returns false without changing the journal if the whole chat file has
+    // to be written instead: the version or header changed, the files are not as they were last saved, or the journal
+    // would grow larger than the chat file.
+    bool append(const QString &chatFilePath, int version, const QByteArray &header,
+                const std::function<void(QDataStream &)> &writeRecord);
+
+    qint64 size() const { return m_size; }
+
+private:
+    int        m_version = 0; // 0 if there is no chat file to append to
+    QByteArray m_header;
+    qint64     m_size    = 0;
+};
+
+#endif // CHATJOURNAL_H
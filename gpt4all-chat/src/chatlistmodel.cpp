@@ -1,16 +1,20 @@
 #include "chatlistmodel.h"
 
+#include "chatllm.h"
 #include "database.h" // IWYU pragma: keep
 #include "mysettings.h"
 
+#include <QCoreApplication>
 #include <QDataStream>
 #include <QDir>
 #include <QElapsedTimer>
 #include <QFile>
 #include <QFileInfo>
+#include <QDateTime>
 #include <QGlobalStatic>
-#include <QGuiApplication>
+#include <QHash>
 #include <QIODevice>
+#include <QSaveFile>
 #include <QSettings>
 #include <QString>
 #include <QStringList>
@@ -18,9 +22,11 @@
 
 #include <algorithm>
 #include <memory>
+#include <optional>
+#include <vector>
 
 static constexpr quint32 CHAT_FORMAT_MAGIC   = 0xF5D553CC;
-static constexpr qint32  CHAT_FORMAT_VERSION = 12;
+static constexpr qint32  CHAT_FORMAT_VERSION = 13;
 
 class MyChatListModel: public ChatListModel { };
 Q_GLOBAL_STATIC(MyChatListModel, chatListModelInstance)
@@ -47,7 +53,7 @@ void ChatListModel::loadChats()
     addChat();
 
     ChatsRestoreThread *thread = new ChatsRestoreThread;
-    connect(thread, &ChatsRestoreThread::chatRestored, this, &ChatListModel::restoreChat, Qt::QueuedConnection);
+    connect(thread, &ChatsRestoreThread::chatsRestored, this, &ChatListModel::restoreChats, Qt::QueuedConnection);
     connect(thread, &ChatsRestoreThread::finished, this, &ChatListModel::chatsRestoredFinished, Qt::QueuedConnection);
     connect(thread, &ChatsRestoreThread::finished, thread, &QObject::deleteLater);
     thread->start();
@@ -66,11 +72,16 @@ void ChatListModel::removeChatFile(Chat *chat) const
     Q_ASSERT(chat != m_serverChat);
     const QString savePath = MySettings::globalInstance()->modelPath();
     QFile file(savePath + "/gpt4all-" + chat->id() + ".chat");
-    if (!file.exists())
-        return;
-    bool success = file.remove();
-    if (!success)
+    if (file.exists() && !file.remove())
         qWarning() << "ERROR: Couldn't remove chat file:" << file.fileName();
+
+    QFile journalFile(ChatJournal::path(file.fileName()));
+    if (journalFile.exists() && !journalFile.remove())
+        qWarning() << "ERROR: Couldn't remove chat journal:" << journalFile.fileName();
+
+    QFile contextFile(ChatLLM::contextFilePath(chat->id()));
+    if (contextFile.exists() && !contextFile.remove())
+        qWarning() << "ERROR: Couldn't remove chat context file:" << contextFile.fileName();
 }
 
 ChatSaver::ChatSaver()
@@ -135,12 +146,18 @@ void ChatSaver::saveChats(const QVector<Chat *> &chats)
 
         QString fileName = "gpt4all-" + chat->id() + ".chat";
         QString filePath = savePath + "/" + fileName;
+        if (chat->appendToJournal(filePath, CHAT_FORMAT_VERSION)) {
+            chat->setNeedsSave(false);
+            continue;
+        }
+
         QFile originalFile(filePath);
         QFile tempFile(filePath + ".tmp"); // Temporary file
 
         bool success = tempFile.open(QIODevice::WriteOnly);
         if (!success) {
             qWarning() << "ERROR: Couldn't save chat to temporary file:" << tempFile.fileName();
+            chat->markSaveFailed();
             continue;
         }
         QDataStream out(&tempFile);
@@ -153,6 +170,7 @@ void ChatSaver::saveChats(const QVector<Chat *> &chats)
         if (!chat->serialize(out, CHAT_FORMAT_VERSION)) {
             qWarning() << "ERROR: Couldn't serialize chat to file:" << tempFile.fileName();
             tempFile.remove();
+            chat->markSaveFailed();
             continue;
         }
 
@@ -160,6 +178,9 @@ void ChatSaver::saveChats(const QVector<Chat *> &chats)
         if (originalFile.exists())
             originalFile.remove();
         tempFile.rename(filePath);
+        // the journal applies to the old chat file; if it cannot be removed, it is ignored when loading
+        QFile::remove(ChatJournal::path(filePath));
+        chat->markSaved(CHAT_FORMAT_VERSION);
     }
 
     qint64 elapsedTime = timer.elapsed();
@@ -167,18 +188,131 @@ void ChatSaver::saveChats(const QVector<Chat *> &chats)
     emit saveChatsFinished();
 }
 
+// The index caches the header of each chat file, so that the chat list can be populated at startup without opening
+// every chat file. An entry is used only if the size and modification time of its file are unchanged, and the index is
+// rewritten at startup if any entry was added, updated or removed.
+static constexpr quint32 CHAT_INDEX_MAGIC   = 0x1C4A7D02;
+static constexpr qint32  CHAT_INDEX_VERSION = 1;
+
+// the index of the chats in the model path
+static QString chatIndexPath()
+{
+    return MySettings::globalInstance()->modelPath() + "/gpt4all-chats.index";
+}
+
+struct ChatIndexEntry {
+    qint64     size;
+    qint64     modified; // ms since epoch
+    qint32     version;
+    qint64     headerOffset;
+    QByteArray header;
+};
+
+static QDataStream &operator<<(QDataStream &out, const ChatIndexEntry &entry)
+{
+    return out << entry.size << entry.modified << entry.version << entry.headerOffset << entry.header;
+}
+
+static QDataStream &operator>>(QDataStream &in, ChatIndexEntry &entry)
+{
+    return in >> entry.size >> entry.modified >> entry.version >> entry.headerOffset >> entry.header;
+}
+
+static QHash<QString, ChatIndexEntry> readChatIndex()
+{
+    QHash<QString, ChatIndexEntry> index;
+    QFile file(chatIndexPath());
+    if (!file.open(QIODevice::ReadOnly))
+        return index; // not created yet
+
+    QDataStream in(&file);
+    quint32 magic;
+    qint32 version;
+    in >> magic >> version;
+    if (magic != CHAT_INDEX_MAGIC || version != CHAT_INDEX_VERSION) {
+        qWarning() << "WARNING: ignoring chat index with unknown format:" << file.fileName();
+        return index;
+    }
+    in.setVersion(QDataStream::Qt_6_2);
+    in >> index;
+    if (in.status() != QDataStream::Ok) {
+        qWarning() << "WARNING: ignoring corrupt chat index:" << file.fileName();
+        index.clear();
+    }
+    return index;
+}
+
+static void writeChatIndex(const QHash<QString, ChatIndexEntry> &index)
+{
+    QSaveFile file(chatIndexPath());
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "WARNING: Couldn't write chat index:" << file.fileName() << file.errorString();
+        return;
+    }
+    QDataStream out(&file);
+    out << CHAT_INDEX_MAGIC << CHAT_INDEX_VERSION;
+    out.setVersion(QDataStream::Qt_6_2);
+    out << index;
+    if (out.status() != QDataStream::Ok || !file.commit())
+        qWarning() << "WARNING: Couldn't write chat index:" << file.fileName() << file.errorString();
+}
+
+// Reads the header of a chat file into chat, and returns its index entry. Returns std::nullopt if it is not a chat file
+// this version can read.
+static std::optional<ChatIndexEntry> readChatHeader(const QFileInfo &info, Chat &chat)
+{
+    QFile file(info.filePath());
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "ERROR: Couldn't restore chat from file:" << file.fileName();
+        return std::nullopt;
+    }
+    QDataStream in(&file);
+
+    // Read and check the header
+    quint32 magic;
+    in >> magic;
+    if (magic != CHAT_FORMAT_MAGIC) {
+        qWarning() << "ERROR: Chat file has bad magic:" << file.fileName();
+        return std::nullopt;
+    }
+
+    // Read the version
+    qint32 version;
+    in >> version;
+    if (version < 1) {
+        qWarning() << "WARNING: Chat file version" << version << "is not supported:" << file.fileName();
+        return std::nullopt;
+    }
+    if (version > CHAT_FORMAT_VERSION) {
+        qWarning().nospace() << "WARNING: Chat file is from a future version (have " << version << " want "
+                             << CHAT_FORMAT_VERSION << "): " << file.fileName();
+        return std::nullopt;
+    }
+
+    if (version < 2)
+        in.setVersion(QDataStream::Qt_6_2);
+
+    ChatIndexEntry entry { info.size(), info.lastModified().toMSecsSinceEpoch(), version, file.pos(), {} };
+    if (!chat.deserializeHeader(in, version)) {
+        qWarning() << "ERROR: Couldn't deserialize chat from file:" << file.fileName();
+        return std::nullopt;
+    }
+    qint64 headerEnd = file.pos();
+    if (!file.seek(entry.headerOffset))
+        return std::nullopt;
+    entry.header = file.read(headerEnd - entry.headerOffset);
+    return entry;
+}
+
 void ChatsRestoreThread::run()
 {
     QElapsedTimer timer;
     timer.start();
-    struct FileInfo {
-        bool oldFile;
-        qint64 creationDate;
-        QString file;
-    };
-    QList<FileInfo> files;
+    std::vector<std::unique_ptr<Chat>> chats;
+
     {
-        // Look for any files in the original spot which was the settings config directory
+        // Look for any files in the original spot which was the settings config directory. These are fully
+        // deserialized, since they are moved to the model path the next time the chats are saved.
         QSettings settings;
         QFileInfo settingsInfo(settings.fileName());
         QString settingsPath = settingsInfo.absolutePath();
@@ -194,123 +328,95 @@ void ChatsRestoreThread::run()
                 continue;
             }
             QDataStream in(&file);
-            FileInfo info;
-            info.oldFile = true;
-            info.file = filePath;
-            in >> info.creationDate;
-            files.append(info);
-            file.close();
-        }
-    }
-    {
-        const QString savePath = MySettings::globalInstance()->modelPath();
-        QDir dir(savePath);
-        dir.setNameFilters(QStringList() << "gpt4all-*.chat");
-        QStringList fileNames = dir.entryList();
-        for (const QString &f : fileNames) {
-            QString filePath = savePath + "/" + f;
-            QFile file(filePath);
-            bool success = file.open(QIODevice::ReadOnly);
-            if (!success) {
-                qWarning() << "ERROR: Couldn't restore chat from file:" << file.fileName();
-                continue;
-            }
-            QDataStream in(&file);
-            // Read and check the header
-            quint32 magic;
-            in >> magic;
-            if (magic != CHAT_FORMAT_MAGIC) {
-                qWarning() << "ERROR: Chat file has bad magic:" << file.fileName();
-                continue;
-            }
 
-            // Read the version
-            qint32 version;
-            in >> version;
-            if (version < 1) {
-                qWarning() << "WARNING: Chat file version" << version << "is not supported:" << file.fileName();
-                continue;
-            }
-            if (version > CHAT_FORMAT_VERSION) {
-                qWarning().nospace() << "WARNING: Chat file is from a future version (have " << version << " want "
-                                     << CHAT_FORMAT_VERSION << "): " << file.fileName();
-                continue;
+            qDebug() << "deserializing chat" << filePath;
+
+            auto chat = std::make_unique<Chat>();
+            chat->moveToThread(QCoreApplication::instance()->thread());
+            bool ok = chat->deserialize(in, /*version*/ 0);
+            if (!ok) {
+                qWarning() << "ERROR: Couldn't deserialize chat from file:" << file.fileName();
+            } else if (!in.atEnd()) {
+                qWarning().nospace() << "error loading chat from " << file.fileName() << ": extra data at end of file";
+            } else {
+                chat->setNeedsSave(true);
+                chats.push_back(std::move(chat));
             }
-
-            if (version < 2)
-                in.setVersion(QDataStream::Qt_6_2);
-
-            FileInfo info;
-            info.oldFile = false;
-            info.file = filePath;
-            in >> info.creationDate;
-            files.append(info);
-            file.close();
+            file.remove(); // No longer storing in this directory
         }
     }
-    std::sort(files.begin(), files.end(), [](const FileInfo &a, const FileInfo &b) {
-        return a.creationDate > b.creationDate;
-    });
-
-    for (FileInfo &f : files) {
-        QFile file(f.file);
-        bool success = file.open(QIODevice::ReadOnly);
-        if (!success) {
-            qWarning() << "ERROR: Couldn't restore chat from file:" << file.fileName();
-            continue;
-        }
-        QDataStream in(&file);
-
-        qint32 version = 0;
-        if (!f.oldFile) {
-            // Read and check the header
-            quint32 magic;
-            in >> magic;
-            if (magic != CHAT_FORMAT_MAGIC) {
-                qWarning() << "ERROR: Chat file has bad magic:" << file.fileName();
-                continue;
-            }
 
-            // Read the version
-            in >> version;
-            if (version < 1) {
-                qWarning() << "ERROR: Chat file has non supported version:" << file.fileName();
-                continue;
+    {
+        const QString savePath = MySettings::globalInstance()->modelPath();
+        QHash<QString, ChatIndexEntry> oldIndex = readChatIndex();
+        QHash<QString, ChatIndexEntry> index;
+        bool indexChanged = false;
+
+        const auto infos = QDir(savePath).entryInfoList(QStringList() << "gpt4all-*.chat", QDir::Files);
+        for (const QFileInfo &info : infos) {
+            auto chat = std::make_unique<Chat>();
+            chat->moveToThread(QCoreApplication::instance()->thread());
+
+            std::optional<ChatIndexEntry> entry;
+            if (auto it = oldIndex.constFind(info.fileName()); it != oldIndex.cend() && it->size == info.size()
+                    && it->modified == info.lastModified().toMSecsSinceEpoch()) {
+                entry = *it;
+                QDataStream in(entry->header);
+                if (entry->version < 2)
+                    in.setVersion(QDataStream::Qt_6_2);
+                if (!chat->deserializeHeader(in, entry->version) || !in.atEnd()) {
+                    qWarning() << "ERROR: Couldn't deserialize chat from index:" << info.filePath();
+                    indexChanged = true;
+                    continue;
+                }
+            } else {
+                indexChanged = true;
+                entry = readChatHeader(info, *chat);
+                if (!entry)
+                    continue;
             }
 
-            if (version < 2)
-                in.setVersion(QDataStream::Qt_6_2);
+            chat->deferContent(info.filePath(), entry->headerOffset + entry->header.size(), entry->version);
+            chats.push_back(std::move(chat));
+            index.insert(info.fileName(), *entry);
         }
 
-        qDebug() << "deserializing chat" << f.file;
-
-        auto chat = std::make_unique<Chat>();
-        chat->moveToThread(qGuiApp->thread());
-        bool ok = chat->deserialize(in, version);
-        if (!ok) {
-            qWarning() << "ERROR: Couldn't deserialize chat from file:" << file.fileName();
-        } else if (!in.atEnd()) {
-            qWarning().nospace() << "error loading chat from " << file.fileName() << ": extra data at end of file";
-        } else {
-            emit chatRestored(chat.release());
-        }
-        if (f.oldFile)
-           file.remove(); // No longer storing in this directory
-        file.close();
+        if (indexChanged || index.size() != oldIndex.size())
+            writeChatIndex(index);
     }
 
+    std::ranges::sort(chats, [](auto &a, auto &b) { return a->creationDate() > b->creationDate(); });
+
+    QList<Chat *> restored;
+    restored.reserve(chats.size());
+    for (auto &chat : chats)
+        restored << chat.release();
+    emit chatsRestored(restored);
+
     qint64 elapsedTime = timer.elapsed();
-    qDebug() << "deserializing chats took:" << elapsedTime << "ms";
+    qDebug() << "restoring chats took:" << elapsedTime << "ms";
 }
 
-void ChatListModel::restoreChat(Chat *chat)
+// how many of the most recent chats to read ahead of being opened
+static constexpr int CHAT_PREFETCH_COUNT = 3;
+
+void ChatListModel::restoreChats(const QList<Chat *> &chats)
 {
-    chat->setParent(this);
-    connect(chat, &Chat::nameChanged, this, &ChatListModel::nameChanged);
+    if (chats.isEmpty())
+        return;
+
+    for (auto *chat : chats) {
+        chat->setParent(this);
+        connect(chat, &Chat::nameChanged, this, &ChatListModel::nameChanged);
+    }
 
-    beginInsertRows(QModelIndex(), m_chats.size(), m_chats.size());
-    m_chats.append(chat);
+    beginInsertRows(QModelIndex(), m_chats.size(), m_chats.size() + chats.size() - 1);
+    m_chats.append(chats);
     endInsertRows();
+    emit countChanged();
+
+    for (auto *chat : chats.first(std::min(qsizetype(CHAT_PREFETCH_COUNT), chats.size())))
+        chat->prefetchContent();
 }
 
 void ChatListModel::chatsRestoredFinished()
@@ -29,7 +29,7 @@ public:
     void run() override;
 
 Q_SIGNALS:
-    void chatRestored(Chat *chat);
+    void chatsRestored(const QList<Chat *> &chats);
 };
 
 class ChatSaver : public QObject
@@ -211,10 +211,17 @@ public:
 
         if (m_currentChat && m_currentChat != m_serverChat)
             m_currentChat->unloadModel();
+        chat->loadContent();
         m_currentChat = chat;
         emit currentChatChanged();
         if (!m_currentChat->isModelLoaded() && m_currentChat != m_serverChat)
             m_currentChat->trySwitchContextOfLoadedModel();
+
+        // the user is likely to open a neighbor next
+        const int index = m_chats.indexOf(chat);
+        for (int i : { index - 1, index + 1 })
+            if (i >= 0 && i < m_chats.size())
+                m_chats.at(i)->prefetchContent();
     }
 
     Q_INVOKABLE Chat* get(int index)
@@ -235,7 +242,7 @@ public:
     void removeChatFile(Chat *chat) const;
     Q_INVOKABLE void saveChats();
     Q_INVOKABLE void saveChatsForQuit();
-    void restoreChat(Chat *chat);
+    void restoreChats(const QList<Chat *> &chats);
     void chatsRestoredFinished();
 
 public Q_SLOTS:
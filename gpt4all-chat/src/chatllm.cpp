@@ -5,6 +5,7 @@
 #include "chatmodel.h"
 #include "jinja_helpers.h"
 #include "localdocs.h"
+#include "metrics.h"
 #include "mysettings.h"
 #include "network.h"
 #include "tool.h"
@@ -15,7 +16,9 @@
 #include <minja/minja.hpp>
 #include <nlohmann/json.hpp>
 
+#include <QCoreApplication>
 #include <QDataStream>
+#include <QDateTime>
 #include <QDebug>
 #include <QFile>
 #include <QGlobalStatic>
@@ -28,7 +31,9 @@
 #include <QMutexLocker> // IWYU pragma: keep
 #include <QRegularExpression>
 #include <QRegularExpressionMatch>
+#include <QSaveFile>
 #include <QSet>
+#include <QStringDecoder>
 #include <QUrl>
 #include <QWaitCondition>
 #include <Qt>
@@ -147,6 +152,8 @@ void LLModelStore::destroy()
 void LLModelInfo::resetModel(ChatLLM *cllm, LLModel *model) {
     this->model.reset(model);
     fallbackReason.reset();
+    specialTokens.reset();
+    contextChatId.clear();
     emit cllm->loadedModelInfoChanged();
 }
 
@@ -178,7 +185,9 @@ ChatLLM::ChatLLM(Chat *parent, bool isServer)
         Qt::BlockingQueuedConnection);
 
     m_llmThread.setObjectName(parent->id());
-    m_llmThread.start();
+    // the server chat is always active; other chats start their thread on the first request, see wake
+    if (m_isServer)
+        m_llmThread.start();
 }
 
 ChatLLM::~ChatLLM()
@@ -195,6 +204,7 @@ void ChatLLM::destroy()
     // The only time we should have a model loaded here is on shutdown
     // as we explicitly unload the model in all other circumstances
     if (isModelLoaded()) {
+        saveContext(); // the thread has finished, so this is safe to do from here
         m_llModelInfo.resetModel(this);
     }
 }
@@ -206,11 +216,51 @@ void ChatLLM::destroyStore()
 
 void ChatLLM::handleThreadStarted()
 {
-    m_timer = new TokenTimer(this);
-    connect(m_timer, &TokenTimer::report, this, &ChatLLM::reportSpeed);
+    if (!m_timer) { // not the first time if the thread was parked
+        m_timer = new TokenTimer(this);
+        connect(m_timer, &TokenTimer::report, this, &ChatLLM::reportSpeed);
+    }
     emit threadStarted();
 }
 
+// Most saved chats are never touched in a session, and those that are sit idle once the user moves on, so the thread
+// of a chat runs only while it has work. A chat's requests are still handled one at a time, in order, on its own
+// thread: loading a model can block the thread until another chat gives the model back to the store, so chats cannot
+// take turns on a shared one.
+void ChatLLM::wake()
+{
+    QMutexLocker locker(&m_llmThreadMutex);
+    m_wakeCount++;
+    if (m_llmThreadParking) {
+        m_llmThread.wait(); // it is about to finish
+        m_llmThreadParking = false;
+    }
+    if (!m_llmThread.isRunning())
+        m_llmThread.start();
+}
+
+// Stops the thread once the requests posted so far are handled, unless more arrive in the meantime.
+void ChatLLM::scheduleParkThread()
+{
+    quint64 wakeCount;
+    {
+        QMutexLocker locker(&m_llmThreadMutex);
+        wakeCount = m_wakeCount;
+    }
+    QMetaObject::invokeMethod(this, [this, wakeCount] { parkThreadIfIdle(wakeCount); }, Qt::QueuedConnection);
+}
+
+void ChatLLM::parkThreadIfIdle(quint64 wakeCount)
+{
+    QMutexLocker locker(&m_llmThreadMutex);
+    // a request posted after the park was scheduled is followed by a wake, which either bumps the count before we get
+    // here or restarts the thread after it finishes
+    if (wakeCount != m_wakeCount || m_isServer || isModelLoaded() || m_shouldBeLoaded)
+        return;
+    m_llmThreadParking = true;
+    m_llmThread.quit();
+}
+
 void ChatLLM::handleForceMetalChanged(bool forceMetal)
 {
 #if defined(Q_OS_MAC) && defined(__aarch64__)
@@ -281,6 +331,7 @@ void ChatLLM::trySwitchContextOfLoadedModel(const ModelInfo &modelInfo)
     qDebug() << "store had our model" << m_llmThread.objectName() << m_llModelInfo.model.get();
 #endif
 
+    restoreContext();
     emit trySwitchContextOfLoadedModelCompleted(2);
     emit modelLoadingPercentageChanged(1.0f);
     emit trySwitchContextOfLoadedModelCompleted(0);
@@ -345,6 +396,7 @@ bool ChatLLM::loadModel(const ModelInfo &modelInfo)
             Q_ASSERT(!m_modelInfo.filename().isEmpty());
             if (m_modelInfo.filename().isEmpty())
                 emit modelLoadingError(u"Modelinfo is left null for %1"_s.arg(modelInfo.filename()));
+            restoreContext();
             return true;
         } else {
             // Release the memory since we have to switch to a different model.
@@ -419,8 +471,10 @@ bool ChatLLM::loadModel(const ModelInfo &modelInfo)
         emit modelLoadingError(u"Could not find file for model %1"_s.arg(modelInfo.filename()));
     }
 
-    if (m_llModelInfo.model)
+    if (m_llModelInfo.model) {
         setModelInfo(modelInfo);
+        restoreContext();
+    }
     return bool(m_llModelInfo.model);
 }
 
@@ -614,6 +668,8 @@ bool ChatLLM::loadNewModel(const ModelInfo &modelInfo, QVariantMap &modelLoadPro
     }
 
     modelLoadProps.insert("$duration", modelLoadTimer.elapsed() / 1000.);
+    if (isModelLoaded())
+        Metrics::globalInstance()->recordModelLoad(modelLoadTimer.nsecsElapsed() / 1e9);
     return true;
 }
 
@@ -639,6 +695,7 @@ bool isAllSpace(R &&r)
 void ChatLLM::regenerateResponse(int index)
 {
     Q_ASSERT(m_chatModel);
+    m_promptPending = false;
     if (m_chatModel->regenerateResponse(index)) {
         emit responseChanged();
         prompt(m_chat->collectionList());
@@ -700,6 +757,7 @@ static LLModel::PromptContext promptContextFromSettings(const ModelInfo &modelIn
 
 void ChatLLM::prompt(const QStringList &enabledCollections)
 {
+    m_promptPending = false;
     if (!isModelLoaded()) {
         emit responseStopped(0);
         return;
@@ -764,7 +822,7 @@ std::optional<std::string> ChatLLM::checkJinjaTemplateError(const std::string &s
     return std::nullopt;
 }
 
-std::string ChatLLM::applyJinjaTemplate(std::span<const MessageItem> items) const
+std::string ChatLLM::applyJinjaTemplate(std::span<const MessageItem> items)
 {
     Q_ASSERT(items.size() >= 1);
 
@@ -807,25 +865,24 @@ std::string ChatLLM::applyJinjaTemplate(std::span<const MessageItem> items) cons
     for (auto &item : items)
         messages.emplace_back(makeMap(item));
 
-    json::array_t toolList;
-    const int toolCount = ToolModel::globalInstance()->count();
-    for (int i = 0; i < toolCount; ++i) {
-        Tool *t = ToolModel::globalInstance()->get(i);
-        toolList.push_back(t->jinjaValue());
-    }
-
     json::object_t params {
-        { "messages",              std::move(messages) },
-        { "add_generation_prompt", true                },
-        { "toolList",              toolList            },
+        { "messages",              std::move(messages)                          },
+        { "add_generation_prompt", true                                         },
+        { "toolList",              ToolModel::globalInstance()->jinjaToolList() },
     };
-    for (auto &[name, token] : model->specialTokens())
-        params.emplace(std::move(name), std::move(token));
+    if (!m_llModelInfo.specialTokens)
+        m_llModelInfo.specialTokens = model->specialTokens();
+    for (auto &[name, token] : *m_llModelInfo.specialTokens)
+        params.emplace(name, token);
 
     try {
-        auto tmpl = loadJinjaTemplate(chatTemplate.toStdString());
+        // parsing is much slower than rendering for long templates, and this runs several times per response
+        if (!m_jinjaTemplate || chatTemplate != m_jinjaTemplateSource) {
+            m_jinjaTemplate = loadJinjaTemplate(chatTemplate.toStdString());
+            m_jinjaTemplateSource = chatTemplate;
+        }
         auto context = minja::Context::make(minja::Value(std::move(params)), jinjaEnv());
-        return tmpl->render(context);
+        return m_jinjaTemplate->render(context);
     } catch (const std::runtime_error &e) {
         throw std::runtime_error(fmt::format("Failed to parse chat template: {}", e.what()));
     }
@@ -884,7 +941,8 @@ auto ChatLLM::promptInternalChat(const QStringList &enabledCollections, const LL
 auto ChatLLM::promptInternal(
     const std::variant<std::span<const MessageItem>, std::string_view> &prompt,
     const LLModel::PromptContext &ctx,
-    bool usedLocalDocs
+    bool usedLocalDocs,
+    bool updateChatModel
 ) -> PromptResult
 {
     Q_ASSERT(isModelLoaded());
@@ -921,24 +979,60 @@ auto ChatLLM::promptInternal(
 
     PromptResult result {};
 
-    auto handlePrompt = [this, &result](std::span<const LLModel::Token> batch, bool cached) -> bool {
-        Q_UNUSED(cached)
+    qsizetype cachedTokens = 0;
+    auto handlePrompt = [this, &result, &cachedTokens](std::span<const LLModel::Token> batch, bool cached) -> bool {
         result.promptTokens += batch.size();
+        if (cached)
+            cachedTokens += batch.size();
         m_timer->start();
-        return !m_stopGenerating;
+        return !shouldStopGenerating();
     };
 
     QElapsedTimer totalTime;
     totalTime.start();
     m_timer->start();
+    qint64 firstTokenNs = 0;
 
     ToolCallParser toolCallParser;
-    auto handleResponse = [this, &result, &toolCallParser, &totalTime](LLModel::Token token, std::string_view piece) -> bool {
+    // Only the new piece is decoded and appended to the chat model, so that the cost per token does not grow with
+    // the length of the response. The decoder keeps incomplete UTF-8 sequences until the rest of their bytes arrive.
+    QStringDecoder decoder(QStringDecoder::Utf8);
+    bool atResponseStart = true;
+
+    // Text is handed to the chat model at most once per update interval (about once per frame by default), so that
+    // fast models are not slowed down by the GUI re-laying out the response after every token.
+    const int updateInterval = mySettings->responseUpdateInterval();
+    QElapsedTimer sinceUpdate;
+    QString pendingText;
+    auto flushResponse = [this, &sinceUpdate, &pendingText] {
+        if (!pendingText.isEmpty()) {
+            m_chatModel->appendResponseValue(pendingText);
+            pendingText.clear();
+        }
+        emit responseChanged();
+        sinceUpdate.start();
+    };
+
+    auto handleResponse = [this, &result, &toolCallParser, &totalTime, &firstTokenNs, &decoder, &atResponseStart,
+                           updateInterval, &sinceUpdate, &pendingText, &flushResponse, updateChatModel](
+        LLModel::Token token, std::string_view piece
+    ) -> bool {
         Q_UNUSED(token)
-        result.responseTokens++;
+        if (!result.responseTokens++)
+            firstTokenNs = totalTime.nsecsElapsed();
         m_timer->inc();
 
         toolCallParser.update(piece.data());
+        result.response.append(piece.data(), piece.size());
+
+        if (!updateChatModel) {
+            // API fast path: collect the raw response without any GUI bookkeeping
+            const bool shouldExecuteToolCall = toolCallParser.state() == ToolEnums::ParseState::Complete
+                && toolCallParser.startTag() != ToolCallConstants::ThinkTag;
+            return !shouldExecuteToolCall && !shouldStopGenerating();
+        }
+
+        bool didSplit = false;
 
         // Split the response into two if needed and create chat items
         if (toolCallParser.numberOfBuffers() < 2 && toolCallParser.splitIfPossible()) {
@@ -948,6 +1042,7 @@ auto ChatLLM::promptInternal(
                 m_chatModel->splitThinking({parseBuffers.at(0), parseBuffers.at(1)});
             else
                 m_chatModel->splitToolCall({parseBuffers.at(0), parseBuffers.at(1)});
+            didSplit = true;
         }
 
         // Split the response into three if needed and create chat items
@@ -956,17 +1051,28 @@ auto ChatLLM::promptInternal(
             const auto parseBuffers = toolCallParser.buffers();
             Q_ASSERT(parseBuffers.size() == 3);
             m_chatModel->endThinking({parseBuffers.at(1), parseBuffers.at(2)}, totalTime.elapsed());
+            didSplit = true;
         }
 
-        result.response.append(piece.data(), piece.size());
-        auto respStr = QString::fromUtf8(result.response);
-
         try {
-            const auto parseBuffers = toolCallParser.buffers();
-            if (parseBuffers.size() > 1)
-                m_chatModel->setResponseValue(parseBuffers.last());
-            else
-                m_chatModel->setResponseValue(removeLeadingWhitespace(respStr));
+            if (didSplit) {
+                // the split already put the pending text into the chat items; the current item now holds the last
+                // buffer, so start decoding it afresh
+                pendingText.clear();
+                decoder = QStringDecoder(QStringDecoder::Utf8);
+                m_chatModel->setResponseValue(decoder(toolCallParser.lastBuffer()));
+                atResponseStart = false;
+                flushResponse();
+            } else {
+                QString delta = decoder(QByteArrayView(piece.data(), piece.size()));
+                if (atResponseStart) {
+                    // leading whitespace is dropped from the start of an unsplit response
+                    atResponseStart = removeLeadingWhitespace(delta).isEmpty();
+                }
+                pendingText += delta;
+                if (!sinceUpdate.isValid() || sinceUpdate.elapsed() >= updateInterval)
+                    flushResponse();
+            }
         } catch (const std::exception &e) {
             // We have a try/catch here because the main thread might have removed the response from
             // the chatmodel by erasing the conversation during the response... the main thread sets
@@ -975,34 +1081,56 @@ auto ChatLLM::promptInternal(
             return false;
         }
 
-        emit responseChanged();
-
         const bool shouldExecuteToolCall = toolCallParser.state() == ToolEnums::ParseState::Complete
             && toolCallParser.startTag() != ToolCallConstants::ThinkTag;
 
-        return !shouldExecuteToolCall && !m_stopGenerating;
+        return !shouldExecuteToolCall && !shouldStopGenerating();
+    };
+
+    const uint64_t contextShiftsBefore = m_llModelInfo.model->contextShiftCount();
+    auto recordMetrics = [&] {
+        auto *metrics = Metrics::globalInstance();
+        quint64 evaluatedTokens = result.promptTokens - cachedTokens;
+        metrics->recordPrompt(cachedTokens, evaluatedTokens,
+                              m_llModelInfo.model->contextShiftCount() - contextShiftsBefore);
+        metrics->recordResponse(firstTokenNs / 1e9, evaluatedTokens, result.responseTokens,
+                                totalTime.nsecsElapsed() / 1e9);
     };
 
     try {
         emit promptProcessing();
         m_llModelInfo.model->setThreadCount(mySettings->threadCount());
         m_stopGenerating = false;
+        m_contextChanged = true;
         m_llModelInfo.model->prompt(conversation, handlePrompt, handleResponse, ctx);
     } catch (...) {
         m_timer->stop();
+        recordMetrics();
         throw;
     }
 
     m_timer->stop();
+    recordMetrics();
     qint64 elapsed = totalTime.elapsed();
 
+    // hand over the text generated since the last update
+    if (updateChatModel && !pendingText.isEmpty()) {
+        try {
+            flushResponse();
+        } catch (const std::exception &e) {
+            // the conversation was erased while stopping, see handleResponse
+            Q_ASSERT(m_stopGenerating);
+        }
+    }
+
     const auto parseBuffers = toolCallParser.buffers();
     const bool shouldExecuteToolCall = toolCallParser.state() == ToolEnums::ParseState::Complete
         && toolCallParser.startTag() != ToolCallConstants::ThinkTag;
 
     // trim trailing whitespace
     auto respStr = QString::fromUtf8(result.response);
-    if (!respStr.isEmpty() && (std::as_const(respStr).back().isSpace() || parseBuffers.size() > 1)) {
+    if (updateChatModel && !respStr.isEmpty()
+        && (std::as_const(respStr).back().isSpace() || parseBuffers.size() > 1)) {
         if (parseBuffers.size() > 1)
             m_chatModel->setResponseValue(parseBuffers.last());
         else
@@ -1033,20 +1161,24 @@ void ChatLLM::setShouldBeLoaded(bool b)
 #endif
     m_shouldBeLoaded = b; // atomic
     emit shouldBeLoadedChanged();
+    wake();
 }
 
 void ChatLLM::requestTrySwitchContext()
 {
     m_shouldBeLoaded = true; // atomic
     emit trySwitchContextRequested(modelInfo());
+    wake();
 }
 
 void ChatLLM::handleShouldBeLoadedChanged()
 {
-    if (m_shouldBeLoaded)
+    if (m_shouldBeLoaded) {
         reloadModel();
-    else
+    } else {
         unloadModel();
+        scheduleParkThread();
+    }
 }
 
 void ChatLLM::unloadModel()
@@ -1063,6 +1195,8 @@ void ChatLLM::unloadModel()
     qDebug() << "unloadModel" << m_llmThread.objectName() << m_llModelInfo.model.get();
 #endif
 
+    saveContext();
+
     if (m_forceUnloadModel) {
         m_llModelInfo.resetModel(this);
         m_forceUnloadModel = false;
@@ -1113,17 +1247,19 @@ void ChatLLM::generateName()
         response.append(piece.data(), piece.size());
         QStringList words = QString::fromUtf8(response).simplified().split(u' ', Qt::SkipEmptyParts);
         emit generatedNameChanged(words.join(u' '));
-        return words.size() <= 3;
+        return words.size() <= 3 && !shouldStopSideTask();
     };
 
     try {
-        m_llModelInfo.model->prompt(
+        if (m_llModelInfo.model->promptFork(
             applyJinjaTemplate(forkConversation(chatNamePrompt)),
-            [this](auto &&...) { return !m_stopGenerating; },
+            [this](auto &&...) { return !shouldStopSideTask(); },
             handleResponse,
             promptContextFromSettings(m_modelInfo)
-        );
+        ))
+            m_contextChanged = true; // it did not fit in a fork
     } catch (const std::exception &e) {
+        m_contextChanged = true; // it may have failed part way through the context
         qWarning() << "ChatLLM failed to generate name:" << e.what();
     }
 }
@@ -1179,25 +1315,171 @@ void ChatLLM::generateQuestions(qint64 elapsed)
         // remove processed input from buffer
         if (lastMatchEnd != -1)
             response.erase(0, lastMatchEnd);
-        return true;
+        return !shouldStopSideTask();
     };
 
     QElapsedTimer totalTime;
     totalTime.start();
     try {
-        m_llModelInfo.model->prompt(
+        if (m_llModelInfo.model->promptFork(
             applyJinjaTemplate(forkConversation(suggestedFollowUpPrompt)),
-            [this](auto &&...) { return !m_stopGenerating; },
+            [this](auto &&...) { return !shouldStopSideTask(); },
             handleResponse,
             promptContextFromSettings(m_modelInfo)
-        );
+        ))
+            m_contextChanged = true; // it did not fit in a fork
     } catch (const std::exception &e) {
+        m_contextChanged = true; // it may have failed part way through the context
         qWarning() << "ChatLLM failed to generate follow-up questions:" << e.what();
     }
     elapsed += totalTime.elapsed();
     emit responseStopped(elapsed);
 }
 
+static constexpr quint32 CONTEXT_FORMAT_MAGIC   = 0x4B56C7A1;
+static constexpr qint32  CONTEXT_FORMAT_VERSION = 1;
+
+QString ChatLLM::contextFilePath(const QString &chatId)
+{
+    return u"%1/gpt4all-%2.context"_s.arg(MySettings::globalInstance()->modelPath(), chatId);
+}
+
+// Identifies what a saved context can be restored into: the same model file with the same context size, on the same
+// device. The state format belongs to the llama.cpp version this was built with, hence the application version.
+QByteArray ChatLLM::contextTag() const
+{
+    QByteArray modelId = m_modelInfo.hash;
+    if (modelId.isEmpty()) {
+        const QFileInfo &file = m_llModelInfo.fileInfo;
+        modelId = u"%1:%2:%3"_s.arg(file.absoluteFilePath()).arg(file.size())
+                      .arg(file.lastModified().toMSecsSinceEpoch()).toUtf8();
+    }
+    auto &model = m_llModelInfo.model;
+    return u"%1|%2|%3|%4"_s.arg(QCoreApplication::applicationVersion(), QString::fromUtf8(modelId))
+               .arg(model->contextLength()).arg(device()).toUtf8();
+}
+
+// Saves the model's state and input tokens next to the chat file, so that reopening the chat does not have to process
+// the whole conversation again. The state is compressed, as most of a partly filled context compresses well.
+void ChatLLM::saveContext()
+{
+    if (!m_contextChanged || m_markedForDeletion || m_isServer || !isModelLoaded()
+        || dynamic_cast<const ChatAPI *>(m_llModelInfo.model.get()))
+        return;
+    m_contextChanged = false;
+
+    auto *mySettings = MySettings::globalInstance();
+    if (!mySettings->chatSaveContext())
+        return;
+
+    auto &model = m_llModelInfo.model;
+    size_t stateSize = model->stateSize();
+    if (stateSize > size_t(mySettings->chatSaveContextSize()) * 1024 * 1024) {
+        qDebug() << "not saving the context of chat" << m_chat->id() << "as it is" << stateSize << "bytes";
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QByteArray state(qsizetype(stateSize), Qt::Uninitialized);
+    std::vector<LLModel::Token> tokens;
+    size_t written = model->saveState({ reinterpret_cast<uint8_t *>(state.data()), stateSize }, tokens);
+    if (!written) {
+        qWarning() << "ERROR: Couldn't get the model state of chat" << m_chat->id();
+        return;
+    }
+    state.truncate(qsizetype(written));
+
+    QSaveFile file(contextFilePath(m_chat->id()));
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "ERROR: Couldn't save chat context to file:" << file.fileName() << file.errorString();
+        return;
+    }
+    QDataStream out(&file);
+    out << CONTEXT_FORMAT_MAGIC;
+    out << CONTEXT_FORMAT_VERSION;
+    out.setVersion(QDataStream::Qt_6_2);
+    out << contextTag();
+    out << quint64(tokens.size());
+    out.writeRawData(reinterpret_cast<const char *>(tokens.data()), qsizetype(tokens.size() * sizeof(LLModel::Token)));
+    out << qCompress(state, 1); // favor speed over size
+    if (out.status() != QDataStream::Ok || !file.commit()) {
+        qWarning() << "ERROR: Couldn't save chat context to file:" << file.fileName() << file.errorString();
+        return;
+    }
+
+    qDebug() << "saved context of chat" << m_chat->id() << "(" << tokens.size() << "tokens) in" << timer.elapsed()
+             << "ms";
+}
+
+// Restores the context saved by saveContext, if the model now has the context of a different chat or none at all.
+void ChatLLM::restoreContext()
+{
+    if (m_isServer || !isModelLoaded() || dynamic_cast<const ChatAPI *>(m_llModelInfo.model.get()))
+        return;
+    if (m_llModelInfo.contextChatId == m_chat->id())
+        return; // still ours
+    m_llModelInfo.contextChatId = m_chat->id();
+    m_contextChanged = false;
+
+    if (!MySettings::globalInstance()->chatSaveContext())
+        return;
+
+    QFile file(contextFilePath(m_chat->id()));
+    if (!file.open(QIODevice::ReadOnly))
+        return; // nothing saved
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QDataStream in(&file);
+    quint32 magic;
+    qint32 version;
+    in >> magic;
+    in >> version;
+    if (magic != CONTEXT_FORMAT_MAGIC || version != CONTEXT_FORMAT_VERSION) {
+        qWarning() << "WARNING: Ignoring chat context file with unknown format:" << file.fileName();
+        return;
+    }
+    in.setVersion(QDataStream::Qt_6_2);
+
+    QByteArray tag;
+    in >> tag;
+    if (tag != contextTag())
+        return; // saved with a different model or context size
+
+    auto &model = m_llModelInfo.model;
+    quint64 nTokens;
+    in >> nTokens;
+    if (in.status() != QDataStream::Ok || nTokens > quint64(model->contextLength())) {
+        qWarning() << "WARNING: Ignoring corrupt chat context file:" << file.fileName();
+        return;
+    }
+    std::vector<LLModel::Token> tokens(nTokens);
+    auto tokenBytes = qsizetype(nTokens * sizeof(LLModel::Token));
+    if (in.readRawData(reinterpret_cast<char *>(tokens.data()), tokenBytes) != tokenBytes) {
+        qWarning() << "WARNING: Ignoring corrupt chat context file:" << file.fileName();
+        return;
+    }
+    QByteArray compressed;
+    in >> compressed;
+    QByteArray state = qUncompress(compressed);
+    if (in.status() != QDataStream::Ok || state.isEmpty()) {
+        qWarning() << "WARNING: Ignoring corrupt chat context file:" << file.fileName();
+        return;
+    }
+
+    auto stateSpan = std::span(reinterpret_cast<const uint8_t *>(state.constData()), size_t(state.size()));
+    if (!model->restoreState(stateSpan, tokens)) {
+        qWarning() << "WARNING: Couldn't restore the context of chat" << m_chat->id();
+        return;
+    }
+
+    qDebug() << "restored context of chat" << m_chat->id() << "(" << nTokens << "tokens) in" << timer.elapsed()
+             << "ms";
+}
+
 // this function serialized the cached model state to disk.
 // we want to also serialize n_ctx, and read it at load time.
 bool ChatLLM::serialize(QDataStream &stream, int version)
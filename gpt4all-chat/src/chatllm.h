@@ -11,6 +11,7 @@
 #include <QElapsedTimer>
 #include <QFileInfo>
 #include <QList>      // IWYU pragma: keep
+#include <QMutex>
 #include <QObject>
 #include <QPointer>
 #include <QString>
@@ -26,11 +27,13 @@
 #include <optional>
 #include <span>
 #include <string>
+#include <unordered_map>
 #include <variant>
 
 using namespace Qt::Literals::StringLiterals;
 
 class QDataStream;
+namespace minja { class TemplateNode; }
 
 // NOTE: values serialized to disk, do not change or reuse
 enum class LLModelTypeV0 { // chat versions 2-5
@@ -95,6 +98,8 @@ struct LLModelInfo {
     std::unique_ptr<LLModel> model;
     QFileInfo fileInfo;
     std::optional<QString> fallbackReason;
+    std::optional<std::unordered_map<std::string, std::string>> specialTokens; // cached for the chat template
+    QString contextChatId; // the chat whose conversation is in the model's context, see ChatLLM::restoreContext
 
     // NOTE: This does not store the model type or name on purpose as this is left for ChatLLM which
     // must be able to serialize the information even if it is in the unloaded state
@@ -155,6 +160,8 @@ public:
 
     static void destroyStore();
     static std::optional<std::string> checkJinjaTemplateError(const std::string &source);
+    // where the model's context is saved for a chat, see saveContext
+    static QString contextFilePath(const QString &chatId);
 
     void destroy();
     bool isModelLoaded() const;
@@ -163,6 +170,11 @@ public:
     std::optional<QString> popPrompt(int index);
 
     void stopGenerating() { m_stopGenerating = true; }
+    // called from the GUI thread when a prompt is queued; chat name and follow-up generation give way to it
+    void setPromptPending() { m_promptPending = true; }
+    // Makes sure the thread of this chat is running, so that the requests posted to it are handled. Called from the
+    // GUI thread after posting a request.
+    void wake();
 
     bool shouldBeLoaded() const { return m_shouldBeLoaded; }
     void setShouldBeLoaded(bool b);
@@ -253,20 +265,32 @@ protected:
     ChatPromptResult promptInternalChat(const QStringList &enabledCollections, const LLModel::PromptContext &ctx,
                                         qsizetype startOffset = 0);
     // passing a string_view directly skips templating and uses the raw string
+    // with updateChatModel=false, the response is only collected into the result and ChatModel is not touched
     PromptResult promptInternal(const std::variant<std::span<const MessageItem>, std::string_view> &prompt,
                                 const LLModel::PromptContext &ctx,
-                                bool usedLocalDocs);
+                                bool usedLocalDocs,
+                                bool updateChatModel = true);
+    // polled by promptInternal between tokens; subclasses may stop generation for reasons of their own
+    virtual bool shouldStopGenerating() { return m_stopGenerating; }
 
 private:
     bool loadNewModel(const ModelInfo &modelInfo, QVariantMap &modelLoadProps);
 
     std::vector<MessageItem> forkConversation(const QString &prompt) const;
 
+    // Save and restore the model's context for this chat, if enabled in the settings.
+    void saveContext();
+    void restoreContext();
+    QByteArray contextTag() const;
+
     // Applies the Jinja template. Query mode returns only the last message without special tokens.
     // Returns a (# of messages, rendered prompt) pair.
-    std::string applyJinjaTemplate(std::span<const MessageItem> items) const;
+    std::string applyJinjaTemplate(std::span<const MessageItem> items);
 
     void generateQuestions(qint64 elapsed);
+    bool shouldStopSideTask() const { return m_stopGenerating || m_promptPending; }
+    void scheduleParkThread();
+    void parkThreadIfIdle(quint64 wakeCount);
 
 protected:
     QPointer<ChatModel> m_chatModel;
@@ -275,16 +299,26 @@ private:
     const Chat *m_chat;
     LLModelInfo m_llModelInfo;
     LLModelTypeV1 m_llModelType = LLModelTypeV1::NONE;
+    // the most recently parsed chat template, reused while the template source does not change
+    QString m_jinjaTemplateSource;
+    std::shared_ptr<minja::TemplateNode> m_jinjaTemplate;
     ModelInfo m_modelInfo;
     TokenTimer *m_timer;
+    // Only runs while the chat has work to do, see wake and scheduleParkThread. Requests posted while it is stopped
+    // are kept and handled in order once it runs again.
     QThread m_llmThread;
+    QMutex m_llmThreadMutex;
+    quint64 m_wakeCount = 0;
+    bool m_llmThreadParking = false;
     std::atomic<bool> m_stopGenerating;
+    std::atomic<bool> m_promptPending = false;
     std::atomic<bool> m_shouldBeLoaded;
     std::atomic<bool> m_forceUnloadModel;
     std::atomic<bool> m_markedForDeletion;
     bool m_isServer;
     bool m_forceMetal;
     bool m_reloadingToChangeVariant;
+    bool m_contextChanged = false; // since it was restored or saved
 };
 
 #endif // CHATLLM_H
@@ -135,6 +135,8 @@ void ChatItem::serialize(QDataStream &stream, int version)
             Q_ASSERT(!a.url.isEmpty());
             stream << a.url;
             stream << a.content;
+            if (version >= 13)
+                stream << a.processed;
         }
     }
 
@@ -345,6 +347,10 @@ bool ChatItem::deserialize(QDataStream &stream, int version)
             PromptAttachment a;
             stream >> a.url;
             stream >> a.content;
+            if (version >= 13)
+                stream >> a.processed;
+            else
+                a.process();
             attachments.append(a);
         }
         promptAttachments = attachments;
@@ -9,21 +9,21 @@
 
 #include <fmt/format.h>
 
-#include <QApplication>
 #include <QAbstractListModel>
 #include <QBuffer>
 #include <QByteArray>
-#include <QClipboard>
 #include <QDataStream>
 #include <QJsonDocument>
 #include <QHash>
 #include <QList>
+#include <QMutex>
 #include <QObject>
 #include <QPair>
 #include <QString>
 #include <QVariant>
 #include <QVector>
 #include <Qt>
+#include <QtAlgorithms>
 #include <QtGlobal>
 
 #include <algorithm>
@@ -33,6 +33,11 @@
 #include <utility>
 #include <vector>
 
+#ifndef GPT4ALL_HEADLESS
+#   include <QClipboard>
+#   include <QGuiApplication>
+#endif
+
 using namespace Qt::Literals::StringLiterals;
 namespace ranges = std::ranges;
 namespace views  = std::views;
@@ -48,6 +53,7 @@ struct PromptAttachment {
 public:
     QUrl url;
     QByteArray content;
+    QString processed; // set by process()
 
     QString file() const
     {
@@ -59,18 +65,28 @@ public:
     }
 
     QString processedContent() const
+    {
+        Q_ASSERT(!processed.isNull());
+        return processed;
+    }
+
+    // Converts the content into the text given to the model. This is done once when the file is attached or the chat
+    // is loaded, as converting a spreadsheet is expensive and the text is needed every time the chat is prompted.
+    void process()
     {
         const QString localFilePath = url.toLocalFile();
         const QFileInfo info(localFilePath);
-        if (info.suffix().toLower() != "xlsx")
-            return u"## Attached: %1\n\n%2"_s.arg(file(), content);
+        if (info.suffix().toLower() != "xlsx") {
+            processed = u"## Attached: %1\n\n%2"_s.arg(file(), content);
+            return;
+        }
 
         QBuffer buffer;
         buffer.setData(content);
         buffer.open(QIODevice::ReadOnly);
         const QString md = XLSXToMD::toMarkdown(&buffer);
         buffer.close();
-        return u"## Attached: %1\n\n%2"_s.arg(file(), md);
+        processed = u"## Attached: %1\n\n%2"_s.arg(file(), md);
     }
 
     bool operator==(const PromptAttachment &other) const { return url == other.url; }
@@ -369,6 +385,17 @@ public:
         emit contentChanged();
     }
 
+    void appendValue(const QString &piece)
+    {
+        if (!subItems.empty() && subItems.back()->isCurrentResponse) {
+            subItems.back()->appendValue(piece);
+            return;
+        }
+
+        value.append(piece);
+        emit contentChanged();
+    }
+
     void setToolCallInfo(const ToolCallInfo &info)
     {
         toolCallInfo = info;
@@ -731,6 +758,7 @@ public:
             oldHasError = hasErrorUnlocked();
             Q_ASSERT(size < m_chatItems.size());
             m_chatItems.resize(size);
+            markChangedUnlocked(size);
         }
         endRemoveRows();
         emit countChanged();
@@ -789,6 +817,7 @@ public:
             QMutexLocker locker(&m_mutex);
             oldHasError = hasErrorUnlocked();
             m_chatItems.clear();
+            markChangedUnlocked(0);
         }
         endResetModel();
         emit countChanged();
@@ -811,6 +840,7 @@ public:
 
             ChatItem *item = m_chatItems[index];
             item->setCurrentResponse(b);
+            markChangedUnlocked(index);
         }
 
         emit dataChanged(createIndex(index, 0), createIndex(index, 0), {IsCurrentResponseRole});
@@ -826,6 +856,7 @@ public:
             ChatItem *item = m_chatItems[index];
             if (item->stopped != b) {
                 item->stopped = b;
+                markChangedUnlocked(index);
                 changed = true;
             }
         }
@@ -843,6 +874,23 @@ public:
             index = m_chatItems.count() - 1;
             ChatItem *item = m_chatItems.back();
             item->setValue(value);
+            markChangedUnlocked(index);
+        }
+        emit dataChanged(createIndex(index, 0), createIndex(index, 0), {ValueRole, ContentRole});
+    }
+
+    // Like setResponseValue, but only appends the newly generated text instead of replacing the whole value.
+    void appendResponseValue(const QString &piece)
+    {
+        qsizetype index;
+        {
+            QMutexLocker locker(&m_mutex);
+            if (m_chatItems.isEmpty() || m_chatItems.cend()[-1]->type() != ChatItem::Type::Response)
+                throw std::logic_error("we only set this on a response");
+
+            index = m_chatItems.count() - 1;
+            m_chatItems.back()->appendValue(piece);
+            markChangedUnlocked(index);
         }
         emit dataChanged(createIndex(index, 0), createIndex(index, 0), {ValueRole, ContentRole});
     }
@@ -861,6 +909,7 @@ public:
                 responseIndex = *peer - m_chatItems.cbegin();
             (*promptItem)->sources = sources;
             (*promptItem)->consolidatedSources = ChatItem::consolidateSources(sources);
+            markChangedUnlocked(index);
         }
         if (responseIndex >= 0) {
             emit dataChanged(createIndex(responseIndex, 0), createIndex(responseIndex, 0), {SourcesRole});
@@ -878,6 +927,7 @@ public:
             ChatItem *item = m_chatItems[index];
             if (item->thumbsUpState != b) {
                 item->thumbsUpState = b;
+                markChangedUnlocked(index);
                 changed = true;
             }
         }
@@ -894,6 +944,7 @@ public:
             ChatItem *item = m_chatItems[index];
             if (item->thumbsDownState != b) {
                 item->thumbsDownState = b;
+                markChangedUnlocked(index);
                 changed = true;
             }
         }
@@ -910,6 +961,7 @@ public:
             ChatItem *item = m_chatItems[index];
             if (item->newResponse != newResponse) {
                 item->newResponse = newResponse;
+                markChangedUnlocked(index);
                 changed = true;
             }
         }
@@ -946,6 +998,7 @@ public:
             // Add new response and reset our value
             currentResponse->subItems.push_back(newResponse);
             currentResponse->value = QString();
+            markChangedUnlocked(index);
         }
 
         emit dataChanged(createIndex(index, 0), createIndex(index, 0), {ChildItemsRole, ContentRole});
@@ -975,6 +1028,7 @@ public:
             thinkingItem->setThinkingTime(thinkingTime);
 
             currentResponse->setValue(split.second);
+            markChangedUnlocked(index);
         }
 
         emit dataChanged(createIndex(index, 0), createIndex(index, 0), {ChildItemsRole, ContentRole});
@@ -1010,6 +1064,7 @@ public:
             // Add new response and reset our value
             currentResponse->subItems.push_back(newResponse);
             currentResponse->value = QString();
+            markChangedUnlocked(index);
         }
 
         emit dataChanged(createIndex(index, 0), createIndex(index, 0), {ChildItemsRole, ContentRole});
@@ -1039,6 +1094,7 @@ public:
             // Add tool response
             ChatItem *toolResponseItem = new ChatItem(this, ChatItem::tool_response_tag, toolCallInfo.result);
             currentResponse->subItems.push_back(toolResponseItem);
+            markChangedUnlocked(index);
         }
 
         emit dataChanged(createIndex(index, 0), createIndex(index, 0), {ChildItemsRole, ContentRole});
@@ -1056,6 +1112,7 @@ public:
             ChatItem *item = m_chatItems.back();
             if (!item->subItems.empty()) {
                 item->subItems.clear();
+                markChangedUnlocked(index);
                 changed = true;
             }
         }
@@ -1078,11 +1135,13 @@ public:
             if (last->isError == value)
                 return; // already set
             last->isError = value;
+            markChangedUnlocked(index);
         }
         emit dataChanged(createIndex(index, 0), createIndex(index, 0), {IsErrorRole});
         emit hasErrorChanged(value);
     }
 
+#ifndef GPT4ALL_HEADLESS
     Q_INVOKABLE void copyToClipboard()
     {
         QMutexLocker locker(&m_mutex);
@@ -1106,6 +1165,7 @@ public:
         QClipboard *clipboard = QGuiApplication::clipboard();
         clipboard->setText(item->clipboardContent(), QClipboard::Clipboard);
     }
+#endif
 
     qsizetype count() const { QMutexLocker locker(&m_mutex); return m_chatItems.size(); }
 
@@ -1128,6 +1188,7 @@ public:
     {
         // FIXME: need to serialize new chatitem tree
         QMutexLocker locker(&m_mutex);
+        m_unchangedCount = m_chatItems.size();
         stream << int(m_chatItems.size());
         for (auto itemIt = m_chatItems.cbegin(); itemIt < m_chatItems.cend(); ++itemIt) {
             auto c = *itemIt; // NB: copies
@@ -1193,6 +1254,7 @@ public:
         {
             QMutexLocker locker(&m_mutex);
             m_chatItems = chatItems;
+            m_unchangedCount = m_chatItems.size();
             hasError = hasErrorUnlocked();
         }
         endInsertRows();
@@ -1202,6 +1264,55 @@ public:
         return stream.status() == QDataStream::Ok;
     }
 
+    // Writes the items that were added or changed since the chat was last serialized or deserialized, as the number of
+    // items to keep followed by the items after them. This is what Chat appends to its journal.
+    void serializeChanges(QDataStream &stream, int version) const
+    {
+        Q_ASSERT(version >= 11); // no sources to move between items
+        QMutexLocker locker(&m_mutex);
+        stream << int(m_unchangedCount);
+        stream << int(m_chatItems.size() - m_unchangedCount);
+        for (auto *item : m_chatItems | views::drop(m_unchangedCount))
+            item->serialize(stream, version);
+        m_unchangedCount = m_chatItems.size();
+    }
+
+    // Applies what serializeChanges wrote.
+    bool deserializeChanges(QDataStream &stream, int version)
+    {
+        int keep, size;
+        stream >> keep >> size;
+        if (stream.status() != QDataStream::Ok || keep < 0 || keep > count() || size < 0)
+            return false;
+
+        QList<ChatItem *> chatItems;
+        for (int i = 0; i < size; ++i) {
+            ChatItem *c = new ChatItem(this);
+            if (!c->deserialize(stream, version)) {
+                delete c;
+                qDeleteAll(chatItems);
+                return false;
+            }
+            chatItems << c;
+        }
+
+        bool oldHasError, hasError;
+        beginResetModel();
+        {
+            QMutexLocker locker(&m_mutex);
+            oldHasError = hasErrorUnlocked();
+            m_chatItems.resize(keep);
+            m_chatItems << chatItems;
+            m_unchangedCount = m_chatItems.size();
+            hasError = hasErrorUnlocked();
+        }
+        endResetModel();
+        emit countChanged();
+        if (hasError != oldHasError)
+            emit hasErrorChanged(hasError);
+        return stream.status() == QDataStream::Ok;
+    }
+
 Q_SIGNALS:
     void countChanged();
     void hasErrorChanged(bool value);
@@ -1215,9 +1326,14 @@ private:
         return last->type() == ChatItem::Type::Response && last->isError;
     }
 
+    void markChangedUnlocked(qsizetype index) const
+    { m_unchangedCount = std::min(m_unchangedCount, index); }
+
 private:
     mutable QMutex m_mutex;
     QList<ChatItem *> m_chatItems;
+    // the number of leading items that have not changed since they were last serialized or deserialized
+    mutable qsizetype m_unchangedCount = 0;
 };
 
 #endif // CHATMODEL_H
@@ -1,20 +1,29 @@
 #include "database.h"
 
+#include "embeddingindex.h"
+#include "metrics.h"
 #include "mysettings.h"
 #include "utils.h"
+#include "workerpool.h"
 
 #include <duckx/duckx.hpp>
 #include <fmt/format.h>
 #include <usearch/index_plugins.hpp>
 
 #include <QByteArrayView>
+#include <QCryptographicHash>
 #include <QDebug>
 #include <QDir>
 #include <QDirIterator>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QFileSystemWatcher>
 #include <QIODevice>
+#include <QMetaObject>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QRegularExpression>
+#include <QScopeGuard>
 #include <QSqlError>
 #include <QSqlQuery>
 #include <QTextStream>
@@ -27,6 +36,10 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <memory>
 #include <optional>
 #include <stdexcept>
 
@@ -112,6 +125,7 @@ static const QString INIT_DB_SQL[] = {
             line_to       integer,
             words         integer default 0 not null,
             tokens        integer default 0 not null,
+            hash          blob,
             foreign key(document_id) references documents(id)
         );
     )"_s, uR"(
@@ -155,6 +169,7 @@ static const QString INIT_DB_SQL[] = {
             folder_id     integer not null,
             document_time integer not null,
             document_path text unique not null,
+            content_hash  blob,
             foreign key(folder_id) references folders(id)
         );
     )"_s, uR"(
@@ -168,20 +183,22 @@ static const QString INIT_DB_SQL[] = {
             foreign key(chunk_id)  references chunks(id),
             unique(model, chunk_id)
         );
+    )"_s, uR"(
+        create index chunks_hash on chunks(hash);
     )"_s,
 };
 
 static const QString INSERT_CHUNK_SQL = uR"(
     insert into chunks(document_id, chunk_text,
-        file, title, author, subject, keywords, page, line_from, line_to, words)
-        values(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
+        file, title, author, subject, keywords, page, line_from, line_to, words, hash)
+        values(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
         returning id;
 )"_s;
 
 static const QString INSERT_CHUNK_FTS_SQL = uR"(
-        insert into chunks_fts(document_id, chunk_text,
+        insert into chunks_fts(rowid, document_id, chunk_text,
             file, title, author, subject, keywords)
-            values(?, ?, ?, ?, ?, ?, ?);
+            values(?, ?, ?, ?, ?, ?, ?, ?);
 )"_s;
 
 static const QString SELECT_CHUNKED_DOCUMENTS_SQL[] = {
@@ -205,6 +222,21 @@ static const QString DELETE_CHUNKS_SQL[] = {
     )"_s,
 };
 
+static const QString DELETE_CHUNK_SQL[] = {
+    uR"(
+        delete from embeddings where chunk_id = ?;
+    )"_s, uR"(
+        delete from chunks_fts where rowid = ?;
+    )"_s, uR"(
+        delete from chunks where id = ?;
+    )"_s,
+};
+
+// the text is only needed to hash chunks that were added before chunks had hashes
+static const QString SELECT_DOCUMENT_CHUNK_HASHES_SQL = uR"(
+    select id, hash, case when hash is null then chunk_text end from chunks where document_id = ?;
+)"_s;
+
 static const QString SELECT_CHUNKS_BY_DOCUMENT_SQL = uR"(
     select id from chunks WHERE document_id = ?;
 )"_s;
@@ -639,8 +671,12 @@ static const QString INSERT_DOCUMENTS_SQL = uR"(
     insert into documents(folder_id, document_time, document_path) values(?, ?, ?);
     )"_s;
 
-static const QString UPDATE_DOCUMENT_TIME_SQL = uR"(
-    update documents set document_time = ? where id = ?;
+static const QString UPDATE_DOCUMENT_SQL = uR"(
+    update documents set document_time = ?, content_hash = ? where id = ?;
+    )"_s;
+
+static const QString CLEAR_DOCUMENT_CONTENT_HASH_SQL = uR"(
+    update documents set content_hash = null where id = ?;
     )"_s;
 
 static const QString DELETE_DOCUMENTS_SQL = uR"(
@@ -648,7 +684,7 @@ static const QString DELETE_DOCUMENTS_SQL = uR"(
     )"_s;
 
 static const QString SELECT_DOCUMENT_SQL = uR"(
-    select id, document_time from documents where document_path = ?;
+    select id, document_time, content_hash from documents where document_path = ?;
     )"_s;
 
 static const QString SELECT_DOCUMENTS_SQL = uR"(
@@ -687,16 +723,26 @@ static bool removeDocument(QSqlQuery &q, int document_id)
     return q.exec();
 }
 
-static bool updateDocument(QSqlQuery &q, int id, qint64 document_time)
+static bool updateDocument(QSqlQuery &q, int id, qint64 document_time, const QByteArray &content_hash)
 {
-    if (!q.prepare(UPDATE_DOCUMENT_TIME_SQL))
+    if (!q.prepare(UPDATE_DOCUMENT_SQL))
         return false;
     q.addBindValue(document_time);
+    q.addBindValue(content_hash);
     q.addBindValue(id);
     return q.exec();
 }
 
-static bool selectDocument(QSqlQuery &q, const QString &document_path, int *id, qint64 *document_time)
+static bool clearDocumentContentHash(QSqlQuery &q, int id)
+{
+    if (!q.prepare(CLEAR_DOCUMENT_CONTENT_HASH_SQL))
+        return false;
+    q.addBindValue(id);
+    return q.exec();
+}
+
+static bool selectDocument(QSqlQuery &q, const QString &document_path, int *id, qint64 *document_time,
+                           QByteArray *content_hash)
 {
     if (!q.prepare(SELECT_DOCUMENT_SQL))
         return false;
@@ -707,6 +753,32 @@ static bool selectDocument(QSqlQuery &q, const QString &document_path, int *id,
     if (q.next()) {
         *id = q.value(0).toInt();
         *document_time = q.value(1).toLongLong();
+        *content_hash = q.value(2).toByteArray();
+    }
+    return true;
+}
+
+// whitespace is normalized, so that copies of the same text that were indented or wrapped differently share an embedding
+static QByteArray chunkHash(const QString &text)
+{
+    return QCryptographicHash::hash(text.simplified().toUtf8(), QCryptographicHash::Sha256);
+}
+
+static bool selectDocumentChunkHashes(QSqlQuery &q, int document_id, QList<int> *chunk_ids,
+                                      QHash<QByteArray, int> *chunk_by_hash)
+{
+    if (!q.prepare(SELECT_DOCUMENT_CHUNK_HASHES_SQL))
+        return false;
+    q.addBindValue(document_id);
+    if (!q.exec())
+        return false;
+    while (q.next()) {
+        int chunk_id = q.value(0).toInt();
+        QByteArray hash = q.value(1).toByteArray();
+        if (hash.isEmpty())
+            hash = chunkHash(q.value(2).toString());
+        *chunk_ids << chunk_id;
+        chunk_by_hash->insert(hash, chunk_id);
     }
     return true;
 }
@@ -762,13 +834,58 @@ static const QString GET_COLLECTION_EMBEDDINGS_SQL = uR"(
 static const QString GET_CHUNK_EMBEDDINGS_SQL = uR"(
     select e.chunk_id, e.embedding
     from embeddings e
-    where e.chunk_id in (%1);
+    where e.model = ? and e.chunk_id in (%1);
 )"_s;
 
 static const QString GET_CHUNK_FILE_SQL = uR"(
     select file from chunks where id = ?;
 )"_s;
 
+static const QString SELECT_EMBEDDING_FOLDERS_SQL = uR"(
+    select distinct co.embedding_model, ci.folder_id
+    from collections co
+    join collection_items ci on ci.collection_id = co.id
+    where co.embedding_model is not null;
+)"_s;
+
+static const QString SELECT_COLLECTION_EMBEDDING_FOLDERS_SQL = uR"(
+    select distinct co.embedding_model, ci.folder_id
+    from collections co
+    join collection_items ci on ci.collection_id = co.id
+    where co.embedding_model is not null and co.name in ('%1');
+)"_s;
+
+static const QString GET_FOLDER_EMBEDDING_IDS_SQL = uR"(
+    select chunk_id from embeddings where model = ? and folder_id = ?;
+)"_s;
+
+static const QString GET_FOLDER_EMBEDDINGS_SQL = uR"(
+    select chunk_id, embedding from embeddings where model = ? and folder_id = ?;
+)"_s;
+
+static const QString GET_CHUNK_EMBEDDING_SQL = uR"(
+    select embedding from embeddings where chunk_id = ? and model = ?;
+)"_s;
+
+static const QString GET_EMBEDDING_BY_HASH_SQL = uR"(
+    select e.embedding
+    from chunks c
+    join embeddings e on e.chunk_id = c.id
+    where c.hash = ? and e.model = ?
+    limit 1;
+)"_s;
+
+static const QString SELECT_CHUNK_EMBEDDINGS_SQL = uR"(
+    select model, folder_id, chunk_id from embeddings where chunk_id = ?;
+)"_s;
+
+static const QString SELECT_DOCUMENT_EMBEDDINGS_SQL = uR"(
+    select e.model, e.folder_id, e.chunk_id
+    from embeddings e
+    join chunks c on c.id = e.chunk_id
+    where c.document_id = ?;
+)"_s;
+
 namespace {
     struct Embedding { QString model; int folder_id; int chunk_id; QByteArray data; };
     struct EmbeddingStat { QString lastFile; int nAdded; int nSkipped; };
@@ -776,13 +893,15 @@ namespace {
 
 NAMED_PAIR(EmbeddingFolder, QString, embedding_model, int, folder_id)
 
-static bool sqlAddEmbeddings(QSqlQuery &q, const QList<Embedding> &embeddings, QHash<EmbeddingFolder, EmbeddingStat> &embeddingStats)
+static bool sqlAddEmbeddings(QSqlQuery &q, const QList<Embedding> &embeddings, QHash<EmbeddingFolder, EmbeddingStat> &embeddingStats,
+                             QList<qsizetype> &added)
 {
     if (!q.prepare(INSERT_EMBEDDING_SQL))
         return false;
 
     // insert embedding if needed
-    for (const auto &e: embeddings) {
+    for (qsizetype i = 0; i < embeddings.size(); i++) {
+        const auto &e = embeddings[i];
         q.bindValue(":model", e.model);
         q.bindValue(":chunk_id", e.chunk_id);
         q.bindValue(":embedding", e.data);
@@ -792,6 +911,7 @@ static bool sqlAddEmbeddings(QSqlQuery &q, const QList<Embedding> &embeddings, Q
         auto &stat = embeddingStats[{ e.model, e.folder_id }];
         if (q.numRowsAffected()) {
             stat.nAdded++; // embedding added
+            added << i;
         } else {
             stat.nSkipped++; // embedding no longer needed
         }
@@ -814,22 +934,63 @@ static bool sqlAddEmbeddings(QSqlQuery &q, const QList<Embedding> &embeddings, Q
     return true;
 }
 
+static void embeddingFromBlob(const QByteArray &data, std::vector<float> &embedding)
+{
+    embedding.resize(data.size() / sizeof(float));
+    std::memcpy(embedding.data(), data.constData(), embedding.size() * sizeof(float));
+}
+
+// leaves embedding empty if the chunk has none for this model yet
+static bool getChunkEmbedding(QSqlQuery &q, int chunk_id, const QString &embedding_model, std::vector<float> &embedding)
+{
+    if (!q.prepare(GET_CHUNK_EMBEDDING_SQL))
+        return false;
+    q.addBindValue(chunk_id);
+    q.addBindValue(embedding_model);
+    if (!q.exec())
+        return false;
+    if (q.next())
+        embeddingFromBlob(q.value(0).toByteArray(), embedding);
+    return true;
+}
+
+// any chunk with the same text will do, in any document or folder; leaves embedding empty if there is none
+static bool getEmbeddingByHash(QSqlQuery &q, const QByteArray &hash, const QString &embedding_model,
+                               std::vector<float> &embedding)
+{
+    if (!q.prepare(GET_EMBEDDING_BY_HASH_SQL))
+        return false;
+    q.addBindValue(hash);
+    q.addBindValue(embedding_model);
+    if (!q.exec())
+        return false;
+    if (q.next())
+        embeddingFromBlob(q.value(0).toByteArray(), embedding);
+    return true;
+}
+
 void Database::transaction()
 {
     bool ok = m_db.transaction();
     Q_ASSERT(ok);
+    m_inTransaction = true;
 }
 
 void Database::commit()
 {
     bool ok = m_db.commit();
     Q_ASSERT(ok);
+    m_inTransaction = false;
+    applyEmbeddingIndexChanges();
 }
 
 void Database::rollback()
 {
     bool ok = m_db.rollback();
     Q_ASSERT(ok);
+    m_inTransaction = false;
+    m_pendingIndexRemovals.clear();
+    m_pendingIndexFolderDrops.clear();
 }
 
 bool Database::refreshDocumentIdCache(QSqlQuery &q)
@@ -846,7 +1007,7 @@ bool Database::refreshDocumentIdCache(QSqlQuery &q)
 
 bool Database::addChunk(QSqlQuery &q, int document_id, const QString &chunk_text, const QString &file,
                         const QString &title, const QString &author, const QString &subject, const QString &keywords,
-                        int page, int from, int to, int words, int *chunk_id)
+                        int page, int from, int to, int words, const QByteArray &hash, int *chunk_id)
 {
     if (!q.prepare(INSERT_CHUNK_SQL))
         return false;
@@ -861,12 +1022,14 @@ bool Database::addChunk(QSqlQuery &q, int document_id, const QString &chunk_text
     q.addBindValue(from);
     q.addBindValue(to);
     q.addBindValue(words);
+    q.addBindValue(hash);
     if (!q.exec() || !q.next())
         return false;
     *chunk_id = q.value(0).toInt();
 
     if (!q.prepare(INSERT_CHUNK_FTS_SQL))
         return false;
+    q.addBindValue(*chunk_id);
     q.addBindValue(document_id);
     q.addBindValue(chunk_text);
     q.addBindValue(file);
@@ -882,17 +1045,61 @@ bool Database::addChunk(QSqlQuery &q, int document_id, const QString &chunk_text
 
 bool Database::removeChunksByDocumentId(QSqlQuery &q, int document_id)
 {
+    if (!queueEmbeddingIndexRemovals(q, document_id))
+        return false;
+
+    bool ok = true;
     for (const auto &cmd: DELETE_CHUNKS_SQL) {
-        if (!q.prepare(cmd))
-            return false;
-        q.addBindValue(document_id);
-        if (!q.exec())
-            return false;
+        ok = q.prepare(cmd);
+        if (ok) {
+            q.addBindValue(document_id);
+            ok = q.exec();
+        }
+        if (!ok)
+            break;
     }
+
+    // outside of a transaction, each statement was committed as it ran
+    if (!m_inTransaction)
+        applyEmbeddingIndexChanges(/*verified*/ ok);
+
+    if (!ok)
+        return false;
     m_documentIdCache.remove(document_id);
     return true;
 }
 
+bool Database::removeChunksById(QSqlQuery &q, const QList<int> &chunk_ids)
+{
+    bool ok = true;
+    for (int chunk_id: chunk_ids) {
+        ok = q.prepare(SELECT_CHUNK_EMBEDDINGS_SQL);
+        if (ok) {
+            q.addBindValue(chunk_id);
+            ok = q.exec();
+        }
+        while (ok && q.next())
+            m_pendingIndexRemovals.append({ q.value(0).toString(), q.value(1).toInt(), q.value(2).toInt() });
+
+        for (const auto &cmd: DELETE_CHUNK_SQL) {
+            if (!ok)
+                break;
+            ok = q.prepare(cmd);
+            if (ok) {
+                q.addBindValue(chunk_id);
+                ok = q.exec();
+            }
+        }
+        if (!ok)
+            break;
+    }
+
+    // outside of a transaction, each statement was committed as it ran
+    if (!m_inTransaction)
+        applyEmbeddingIndexChanges(/*verified*/ ok);
+    return ok;
+}
+
 bool Database::sqlRemoveDocsByFolderPath(QSqlQuery &q, const QString &path)
 {
     for (const auto &cmd: FOLDER_REMOVE_ALL_DOCS_SQL) {
@@ -975,10 +1182,10 @@ bool Database::initDb(const QString &modelPath, const QList<CollectionItem> &old
 {
     if (!m_db.isOpen()) {
         int res = openDatabase(modelPath);
-        if (res == 1) return true; // already populated
+        if (res == 1) return addContentHashColumns(); // already populated
         if (res == -1) return false; // error
     } else if (hasContent()) {
-        return true; // already populated
+        return addContentHashColumns(); // already populated
     }
 
     transaction();
@@ -1007,6 +1214,31 @@ bool Database::initDb(const QString &modelPath, const QList<CollectionItem> &old
     return true;
 }
 
+/* Content hashes are only used to avoid indexing unchanged text again, so they were added to existing databases without
+ * a new version. Chunks and documents from before have no hash, and are indexed again in full when they change. */
+bool Database::addContentHashColumns()
+{
+    QSqlQuery q(m_db);
+    const std::pair<QString, QString> columns[] { { u"chunks"_s, u"hash"_s }, { u"documents"_s, u"content_hash"_s } };
+    for (const auto &[table, column]: columns) {
+        if (!q.exec(u"select 1 from pragma_table_info('%1') where name = '%2';"_s.arg(table, column))) {
+            qWarning() << "ERROR: failed to read the columns of" << table << q.lastError();
+            return false;
+        }
+        if (q.next())
+            continue;
+        if (!q.exec(u"alter table %1 add column %2 blob;"_s.arg(table, column))) {
+            qWarning() << "ERROR: failed to add column" << column << "to" << table << q.lastError();
+            return false;
+        }
+    }
+    if (!q.exec(u"create index if not exists chunks_hash on chunks(hash);"_s)) {
+        qWarning() << "ERROR: failed to create index chunks_hash" << q.lastError();
+        return false;
+    }
+    return true;
+}
+
 Database::Database(int chunkSize, QStringList extensions)
     : QObject(nullptr)
     , m_chunkSize(chunkSize)
@@ -1015,8 +1247,12 @@ Database::Database(int chunkSize, QStringList extensions)
     , m_watcher(new QFileSystemWatcher(this))
     , m_embLLM(new EmbeddingLLM)
     , m_databaseValid(true)
-    , m_chunkStreamer(this)
+    , m_indexSaveTimer(new QTimer(this))
 {
+    // batch the embedding index writes made while indexing
+    m_indexSaveTimer->setSingleShot(true);
+    m_indexSaveTimer->setInterval(30000);
+
     m_db = QSqlDatabase::database(QSqlDatabase::defaultConnection, false);
     if (!m_db.isValid())
         m_db = QSqlDatabase::addDatabase("QSQLITE");
@@ -1031,6 +1267,10 @@ Database::~Database()
 {
     m_dbThread.quit();
     m_dbThread.wait();
+    // the workers hold this object, so they must be stopped before it goes away
+    cancelIndexingJobs([](auto &) { return true; });
+    WorkerPool::globalInstance()->waitForDone();
+    saveEmbeddingIndexes();
     delete m_embLLM;
 }
 
@@ -1183,12 +1423,16 @@ private:
     std::optional<QTextStream> m_stream;
 };
 #else
+// PDFium is not thread-safe, and documents are parsed on several worker threads at once
+static QMutex s_pdfiumMutex;
+
 class PdfDocumentReader final : public DocumentReader {
 public:
     explicit PdfDocumentReader(const DocumentInfo &info)
         : DocumentReader(info)
     {
         QString path = info.file.canonicalFilePath();
+        QMutexLocker locker(&s_pdfiumMutex);
         m_doc = FPDF_LoadDocument(path.toUtf8().constData(), nullptr);
         if (!m_doc)
             throw std::runtime_error(fmt::format("Failed to load PDF: {}", path));
@@ -1200,16 +1444,17 @@ public:
             .subject  = getMetadata("Subject" ),
             .keywords = getMetadata("Keywords"),
         };
+        locker.unlock();
         postInit(std::move(metadata));
     }
 
     ~PdfDocumentReader() override
     {
+        QMutexLocker locker(&s_pdfiumMutex);
         if (m_page)
             FPDF_ClosePage(m_page);
         if (m_doc)
             FPDF_CloseDocument(m_doc);
-        FPDF_DestroyLibrary();
     }
 
     int page() const override { return m_currentPage; }
@@ -1220,6 +1465,7 @@ private:
         QString word;
         do {
             while (!m_stream || m_stream->atEnd()) {
+                QMutexLocker locker(&s_pdfiumMutex);
                 if (m_currentPage >= FPDF_GetPageCount(m_doc))
                     return std::nullopt;
 
@@ -1422,58 +1668,25 @@ std::unique_ptr<DocumentReader> DocumentReader::fromDocument(const DocumentInfo
     return std::make_unique<TxtDocumentReader>(doc);
 }
 
-ChunkStreamer::ChunkStreamer(Database *database)
-    : m_database(database) {}
+ChunkStreamer::ChunkStreamer(const DocumentInfo &doc, int maxChunkSize)
+    : m_reader(DocumentReader::fromDocument(doc))
+    , m_maxChunkSize(maxChunkSize) {}
 
 ChunkStreamer::~ChunkStreamer() = default;
 
-void ChunkStreamer::setDocument(const DocumentInfo &doc, int documentId, const QString &embeddingModel)
-{
-    auto docKey = doc.key();
-    if (!m_docKey || *m_docKey != docKey) {
-        m_docKey         = docKey;
-        m_reader         = DocumentReader::fromDocument(doc);
-        m_documentId     = documentId;
-        m_embeddingModel = embeddingModel;
-        m_chunk.clear();
-        m_page = 0;
-
-        // make sure the document doesn't already have any chunks
-        if (m_database->m_documentIdCache.contains(documentId)) {
-            QSqlQuery q(m_database->m_db);
-            if (!m_database->removeChunksByDocumentId(q, documentId))
-                handleDocumentError("ERROR: Cannot remove chunks of document", documentId, doc.file.canonicalPath(), q.lastError());
-        }
-    }
-}
-
-std::optional<DocumentInfo::key_type> ChunkStreamer::currentDocKey() const
+const DocumentReader &ChunkStreamer::reader() const
 {
-    return m_docKey;
+    return *m_reader;
 }
 
-void ChunkStreamer::reset()
+ChunkStreamer::Status ChunkStreamer::step(QList<Chunk> &chunks, int maxChunks)
 {
-    m_docKey.reset();
-}
-
-ChunkStreamer::Status ChunkStreamer::step()
-{
-    // TODO: implement line_from/line_to
-    constexpr int line_from = -1;
-    constexpr int line_to = -1;
-    const int folderId = m_reader->doc().folder;
-    const int maxChunkSize = m_database->m_chunkSize;
+    const int maxChunkSize = m_maxChunkSize;
     int nChunks = 0;
-    int nAddedWords = 0;
-    Status retval;
 
     for (;;) {
-        if (auto error = m_reader->getError()) {
-            m_docKey.reset(); // done processing
-            retval = *error;
-            break;
-        }
+        if (auto error = m_reader->getError())
+            return *error;
 
         // get a word, if needed
         std::optional<QString> word = QString(); // empty string to disable EOF logic
@@ -1530,64 +1743,17 @@ ChunkStreamer::Status ChunkStreamer::step()
                 }
                 Q_ASSERT(chunk.length() <= maxChunkSize);
 
-                QSqlQuery q(m_database->m_db);
-                int chunkId = 0;
-                auto &metadata = m_reader->metadata();
-                if (!m_database->addChunk(q,
-                    m_documentId,
-                    chunk,
-                    m_reader->doc().file.fileName(), // basename
-                    metadata.title,
-                    metadata.author,
-                    metadata.subject,
-                    metadata.keywords,
-                    m_page,
-                    line_from,
-                    line_to,
-                    nThisChunkWords,
-                    &chunkId
-                )) {
-                    qWarning() << "ERROR: Could not insert chunk into db" << q.lastError();
-                }
-
-                nAddedWords += nThisChunkWords;
-
-                EmbeddingChunk toEmbed;
-                toEmbed.model = m_embeddingModel;
-                toEmbed.folder_id = folderId;
-                toEmbed.chunk_id = chunkId;
-                toEmbed.chunk = chunk;
-                m_database->appendChunk(toEmbed);
+                chunks.append({ .text = std::move(chunk), .page = m_page, .words = nThisChunkWords });
                 ++nChunks;
             }
 
-            if (!word) {
-                retval = Status::DOC_COMPLETE;
-                m_docKey.reset(); // done processing
-                break;
-            }
+            if (!word)
+                return Status::DOC_COMPLETE;
         }
 
-        if (m_database->scanQueueInterrupted()) {
-            retval = Status::INTERRUPTED;
-            break;
-        }
+        if (nChunks >= maxChunks)
+            return Status::INTERRUPTED;
     }
-
-    if (nChunks) {
-        CollectionItem item = m_database->guiCollectionItem(folderId);
-
-        // Set the start update if we haven't done so already
-        if (item.startUpdate <= item.lastUpdate && item.currentEmbeddingsToIndex == 0)
-            m_database->setStartUpdateTime(item);
-
-        item.currentEmbeddingsToIndex += nChunks;
-        item.totalEmbeddingsToIndex += nChunks;
-        item.totalWords += nAddedWords;
-        m_database->updateGuiForCollectionItem(item);
-    }
-
-    return retval;
 }
 
 void Database::appendChunk(const EmbeddingChunk &chunk)
@@ -1598,8 +1764,37 @@ void Database::appendChunk(const EmbeddingChunk &chunk)
         sendChunkList();
 }
 
+/* Identical text is only embedded once per embedding model: a chunk takes the embedding of any chunk with the same hash
+ * that has one, or waits for one that is being generated, and is otherwise sent to the embedder. */
+void Database::embedChunk(QSqlQuery &q, const EmbeddingChunk &chunk, const QByteArray &hash,
+                          QVector<EmbeddingResult> &reused)
+{
+    if (hash.isEmpty())
+        return appendChunk(chunk);
+
+    const QPair<QString, QByteArray> key { chunk.model, hash };
+    if (auto it = m_duplicateChunks.find(key); it != m_duplicateChunks.end()) {
+        it->append(chunk);
+        return;
+    }
+
+    std::vector<float> embedding;
+    if (!getEmbeddingByHash(q, hash, chunk.model, embedding))
+        qWarning() << "ERROR: Could not get embedding by hash" << q.lastError();
+    if (!embedding.empty()) {
+        reused.append({ chunk.model, chunk.folder_id, chunk.chunk_id, std::move(embedding) });
+        ++m_embeddingBacklog;
+        return;
+    }
+
+    m_duplicateChunks.insert(key, {});
+    m_embeddingChunkHashes.insert(chunk.chunk_id, hash);
+    appendChunk(chunk);
+}
+
 void Database::sendChunkList()
 {
+    m_embeddingBacklog += m_chunkList.size();
     m_embLLM->generateDocEmbeddingsAsync(m_chunkList);
     m_chunkList.clear();
 }
@@ -1608,8 +1803,22 @@ void Database::handleEmbeddingsGenerated(const QVector<EmbeddingResult> &embeddi
 {
     Q_ASSERT(!embeddings.isEmpty());
 
-    QList<Embedding> sqlEmbeddings;
+    // the embedder has room for more chunks
+    m_embeddingBacklog = std::max<qsizetype>(m_embeddingBacklog - embeddings.size(), 0);
+    auto writeMore = qScopeGuard([this] { writeParsedChunks(); });
+
+    // chunks with the same text were waiting for these
+    QVector<EmbeddingResult> results = embeddings;
     for (const auto &e: embeddings) {
+        QByteArray hash = m_embeddingChunkHashes.take(e.chunk_id);
+        if (hash.isEmpty())
+            continue;
+        for (const auto &c: m_duplicateChunks.take({ e.model, hash }))
+            results.append({ c.model, c.folder_id, c.chunk_id, e.embedding });
+    }
+
+    QList<Embedding> sqlEmbeddings;
+    for (const auto &e: std::as_const(results)) {
         auto data = QByteArray::fromRawData(
             reinterpret_cast<const char *>(e.embedding.data()),
             e.embedding.size() * sizeof(e.embedding.front())
@@ -1621,13 +1830,23 @@ void Database::handleEmbeddingsGenerated(const QVector<EmbeddingResult> &embeddi
 
     QSqlQuery q(m_db);
     QHash<EmbeddingFolder, EmbeddingStat> stats;
-    if (!sqlAddEmbeddings(q, sqlEmbeddings, stats)) {
+    QList<qsizetype> added;
+    if (!sqlAddEmbeddings(q, sqlEmbeddings, stats, added)) {
         qWarning() << "Database ERROR: failed to add embeddings:" << q.lastError();
         return rollback();
     }
 
     commit();
 
+    for (qsizetype i: std::as_const(added)) {
+        const auto &e = results[i];
+        auto *index = embeddingIndex(e.model, e.folder_id);
+        if (index && !index->add(e.chunk_id, e.embedding.data(), e.embedding.size()))
+            index->setVerified(false);
+    }
+    if (!added.isEmpty())
+        m_indexSaveTimer->start();
+
     // FIXME(jared): embedding counts are per-collectionitem, not per-folder
     for (const auto &[key, stat]: std::as_const(stats).asKeyValueRange()) {
         if (!m_collectionMap.contains(key.folder_id)) continue;
@@ -1666,6 +1885,16 @@ void Database::handleErrorGenerated(const QVector<EmbeddingChunk> &chunks, const
      * on the embedding model, but this sets the error on all collections for a given
      * folder */
 
+    // chunks with the same text stay without an embedding, like these, until they are scheduled again
+    for (const auto &c: chunks) {
+        QByteArray hash = m_embeddingChunkHashes.take(c.chunk_id);
+        if (!hash.isEmpty())
+            m_duplicateChunks.remove({ c.model, hash });
+    }
+
+    m_embeddingBacklog = std::max<qsizetype>(m_embeddingBacklog - chunks.size(), 0);
+    writeParsedChunks();
+
     QSet<int> folder_ids;
     for (const auto &c: chunks) { folder_ids << c.folder_id; }
 
@@ -1679,20 +1908,24 @@ void Database::handleErrorGenerated(const QVector<EmbeddingChunk> &chunks, const
 
 size_t Database::countOfDocuments(int folder_id) const
 {
+    size_t count = ranges::count(m_indexingJobs, folder_id, [](auto &job) { return job->folderId; });
     if (auto it = m_docsToScan.find(folder_id); it != m_docsToScan.end())
-        return it->second.size();
-    return 0;
+        count += it->second.size();
+    return count;
 }
 
 size_t Database::countOfBytes(int folder_id) const
 {
+    size_t totalBytes = 0;
+    for (const auto &job : m_indexingJobs) {
+        if (job->folderId == folder_id)
+            totalBytes += job->size;
+    }
     if (auto it = m_docsToScan.find(folder_id); it != m_docsToScan.end()) {
-        size_t totalBytes = 0;
         for (const DocumentInfo &f : it->second)
             totalBytes += f.file.size();
-        return totalBytes;
     }
-    return 0;
+    return totalBytes;
 }
 
 DocumentInfo Database::dequeueDocument()
@@ -1710,20 +1943,22 @@ DocumentInfo Database::dequeueDocument()
 
 void Database::removeFolderFromDocumentQueue(int folder_id)
 {
-    if (auto queueIt = m_docsToScan.find(folder_id); queueIt != m_docsToScan.end()) {
-        if (auto key = m_chunkStreamer.currentDocKey()) {
-            if (ranges::any_of(queueIt->second, [&key](auto &d) { return d.key() == key; }))
-                m_chunkStreamer.reset(); // done with this document
-        }
-        // remove folder from queue
-        m_docsToScan.erase(queueIt);
-    }
+    cancelIndexingJobs([folder_id](auto &job) { return job.folderId == folder_id; });
+    m_docsToScan.erase(folder_id);
 }
 
-void Database::enqueueDocumentInternal(DocumentInfo &&info, bool prepend)
+void Database::cancelIndexingJobs(const std::function<bool(const IndexingJob &)> &matches)
 {
-    auto &queue = m_docsToScan[info.folder];
-    queue.insert(prepend ? queue.begin() : queue.end(), std::move(info));
+    // the worker stops at its next batch, and any batches it has already handed over are dropped
+    m_indexingJobs.removeIf([&matches](auto &job) {
+        if (!matches(*job))
+            return false;
+        job->cancelled = true;
+        return true;
+    });
+    // wake the workers of these jobs that are waiting to hand over a batch
+    QMutexLocker locker(&m_parsedChunkMutex);
+    m_parsedChunkSlotFreed.wakeAll();
 }
 
 void Database::enqueueDocuments(int folder_id, std::list<DocumentInfo> &&infos)
@@ -1733,8 +1968,8 @@ void Database::enqueueDocuments(int folder_id, std::list<DocumentInfo> &&infos)
     queue.splice(queue.end(), std::move(infos));
 
     CollectionItem item = guiCollectionItem(folder_id);
-    item.currentDocsToIndex = queue.size();
-    item.totalDocsToIndex = queue.size();
+    item.currentDocsToIndex = countOfDocuments(folder_id);
+    item.totalDocsToIndex = item.currentDocsToIndex;
     const size_t bytes = countOfBytes(folder_id);
     item.currentBytesToIndex = bytes;
     item.totalBytesToIndex = bytes;
@@ -1747,14 +1982,21 @@ bool Database::scanQueueInterrupted() const
     return m_scanDurationTimer.elapsed() >= 100;
 }
 
+static qsizetype maxIndexingJobs()
+{
+    // leave a worker free, so that searches made while indexing are not left to the calling thread alone
+    return std::max(WorkerPool::globalInstance()->maxThreadCount() - 1, 1);
+}
+
 void Database::scanQueueBatch()
 {
     transaction();
 
     m_scanDurationTimer.start();
 
-    // scan for up to the maximum scan duration or until we run out of documents
-    while (!m_docsToScan.empty()) {
+    // hand documents to the workers for up to the maximum scan duration, until they are all busy, or until we run out
+    // of documents
+    while (!m_docsToScan.empty() && m_indexingJobs.size() < maxIndexingJobs()) {
         scanQueue();
         if (scanQueueInterrupted())
             break;
@@ -1762,14 +2004,14 @@ void Database::scanQueueBatch()
 
     commit();
 
-    if (m_docsToScan.empty())
+    // restarted when a worker finishes a document
+    if (m_docsToScan.empty() || m_indexingJobs.size() >= maxIndexingJobs())
         m_scanIntervalTimer->stop();
 }
 
 void Database::scanQueue()
 {
     DocumentInfo info = dequeueDocument();
-    const size_t countForFolder = countOfDocuments(info.folder);
     const int folder_id = info.folder;
 
     // Update info
@@ -1778,58 +2020,69 @@ void Database::scanQueue()
     // If the doc has since been deleted or no longer readable, then we schedule more work and return
     // leaving the cleanup for the cleanup handler
     if (!info.file.exists() || !info.file.isReadable())
-        return updateFolderToIndex(folder_id, countForFolder);
+        return updateFolderToIndex(folder_id, countOfDocuments(folder_id));
 
     const qint64 document_time = info.file.fileTime(QFile::FileModificationTime).toMSecsSinceEpoch();
     const QString document_path = info.file.canonicalFilePath();
-    const bool currentlyProcessing = info.currentlyProcessing;
 
     // Check and see if we already have this document
     QSqlQuery q(m_db);
     int existing_id = -1;
     qint64 existing_time = -1;
-    if (!selectDocument(q, document_path, &existing_id, &existing_time)) {
+    QByteArray existing_hash;
+    if (!selectDocument(q, document_path, &existing_id, &existing_time, &existing_hash)) {
         handleDocumentError("ERROR: Cannot select document",
             existing_id, document_path, q.lastError());
-        return updateFolderToIndex(folder_id, countForFolder);
+        return updateFolderToIndex(folder_id, countOfDocuments(folder_id));
     }
 
     // If we have the document, we need to compare the last modification time and if it is newer
-    // we must rescan the document, otherwise return
-    if (existing_id != -1 && !currentlyProcessing) {
+    // we must rescan the document, otherwise return. Its chunks are kept until the new version is done, so that the
+    // embeddings of unchanged text can be reused.
+    QList<int> old_chunk_ids;
+    QHash<QByteArray, int> old_chunk_by_hash;
+    if (existing_id != -1) {
         Q_ASSERT(existing_time != -1);
         if (document_time == existing_time) {
             // No need to rescan, but we do have to schedule next
-            return updateFolderToIndex(folder_id, countForFolder);
+            return updateFolderToIndex(folder_id, countOfDocuments(folder_id));
         }
-        if (!removeChunksByDocumentId(q, existing_id)) {
-            handleDocumentError("ERROR: Cannot remove chunks of document",
+
+        // an older version of this document may still be in the workers
+        cancelIndexingJobs([&](auto &job) {
+            if (job.documentId != existing_id)
+                return false;
+            removeBytesToIndex(folder_id, job.size);
+            return true;
+        });
+
+        if (!selectDocumentChunkHashes(q, existing_id, &old_chunk_ids, &old_chunk_by_hash)) {
+            handleDocumentError("ERROR: Cannot select chunks of document",
                 existing_id, document_path, q.lastError());
-            return updateFolderToIndex(folder_id, countForFolder);
+            return updateFolderToIndex(folder_id, countOfDocuments(folder_id));
+        }
+
+        // the hash is set again with the document_time once the new version is done, so that an interrupted
+        // update is neither mistaken for an unchanged document nor skipped on the next scan
+        if (!clearDocumentContentHash(q, existing_id)) {
+            handleDocumentError("ERROR: Could not clear content_hash",
+                existing_id, document_path, q.lastError());
+            return updateFolderToIndex(folder_id, countOfDocuments(folder_id));
         }
-        updateCollectionStatistics();
     }
 
-    // Update the document_time for an existing document, or add it for the first time now
+    // Add the document for the first time now; an existing document keeps its old document_time until it is done
     int document_id = existing_id;
-    if (!currentlyProcessing) {
-        if (document_id != -1) {
-            if (!updateDocument(q, document_id, document_time)) {
-                handleDocumentError("ERROR: Could not update document_time",
-                    document_id, document_path, q.lastError());
-                return updateFolderToIndex(folder_id, countForFolder);
-            }
-        } else {
-            if (!addDocument(q, folder_id, document_time, document_path, &document_id)) {
-                handleDocumentError("ERROR: Could not add document",
-                    document_id, document_path, q.lastError());
-                return updateFolderToIndex(folder_id, countForFolder);
-            }
-
-            CollectionItem item = guiCollectionItem(folder_id);
-            item.totalDocs += 1;
-            updateGuiForCollectionItem(item);
+    if (document_id == -1) {
+        if (!addDocument(q, folder_id, document_time, document_path, &document_id)) {
+            handleDocumentError("ERROR: Could not add document",
+                document_id, document_path, q.lastError());
+            return updateFolderToIndex(folder_id, countOfDocuments(folder_id));
         }
+
+        CollectionItem item = guiCollectionItem(folder_id);
+        item.totalDocs += 1;
+        updateGuiForCollectionItem(item);
     }
 
     // Get the embedding model for this folder
@@ -1838,54 +2091,255 @@ void Database::scanQueue()
     if (!sqlGetFolderEmbeddingModel(q, folder_id, embedding_model)) {
         handleDocumentError("ERROR: Could not get embedding model",
             document_id, document_path, q.lastError());
-        return updateFolderToIndex(folder_id, countForFolder);
+        return updateFolderToIndex(folder_id, countOfDocuments(folder_id));
     }
 
     Q_ASSERT(document_id != -1);
 
+    auto job = std::make_shared<IndexingJob>();
+    job->folderId       = folder_id;
+    job->documentId     = document_id;
+    job->path           = document_path;
+    job->fileName       = info.file.fileName();
+    job->size           = info.file.size();
+    job->embeddingModel = embedding_model;
+    job->chunkSize      = m_chunkSize;
+    job->documentTime   = document_time;
+    job->oldContentHash = existing_hash;
+    job->oldChunkIds    = std::move(old_chunk_ids);
+    job->oldChunkByHash = std::move(old_chunk_by_hash);
+    m_indexingJobs << job;
+    WorkerPool::globalInstance()->start([this, job] { parseDocument(job); });
+    updateFolderToIndex(folder_id, countOfDocuments(folder_id));
+}
+
+// Runs on a worker thread. Batches are handed to the database thread through a bounded queue: when the writer falls
+// behind, the worker waits for room, and it stops as soon as its job is cancelled.
+void Database::parseDocument(const std::shared_ptr<IndexingJob> &job)
+{
+    // a QFileInfo of its own, as they are not safe to share between threads
+    const DocumentInfo info { job->folderId, QFileInfo(job->path) };
+
+    auto handOver = [this, &job](QList<ChunkStreamer::Chunk> chunks, ChunkStreamer::Status status) {
+        if (!acquireParsedChunkSlot(*job))
+            return false;
+        QMetaObject::invokeMethod(this, [this, job, chunks = std::move(chunks), status] {
+            handleParsedChunks(job, chunks, status);
+        }, Qt::QueuedConnection);
+        return true;
+    };
+
+    // a document that was touched without being changed does not need to be parsed again
     {
-        try {
-            m_chunkStreamer.setDocument(info, document_id, embedding_model);
-        } catch (const std::runtime_error &e) {
-            qWarning() << "LocalDocs ERROR:" << e.what();
-            goto dequeue;
+        QFile file(job->path);
+        QCryptographicHash hash(QCryptographicHash::Sha256);
+        if (file.open(QIODevice::ReadOnly) && hash.addData(&file))
+            job->contentHash = hash.result();
+    }
+    if (!job->contentHash.isEmpty() && job->contentHash == job->oldContentHash) {
+        handOver({}, ChunkStreamer::Status::DOC_UNCHANGED);
+        return;
+    }
+
+    std::optional<ChunkStreamer> streamer;
+    try {
+        streamer.emplace(info, job->chunkSize);
+        const auto &metadata = streamer->reader().metadata();
+        job->title    = metadata.title;
+        job->author   = metadata.author;
+        job->subject  = metadata.subject;
+        job->keywords = metadata.keywords;
+    } catch (const std::exception &e) {
+        qWarning() << "LocalDocs ERROR:" << e.what();
+    }
+
+    ChunkStreamer::Status status = ChunkStreamer::Status::ERROR;
+    do {
+        QList<ChunkStreamer::Chunk> chunks;
+        if (streamer) {
+            try {
+                status = streamer->step(chunks, s_batchSize);
+            } catch (const std::exception &e) {
+                qWarning() << "LocalDocs ERROR:" << e.what();
+                status = ChunkStreamer::Status::ERROR;
+            }
         }
+        for (auto &chunk : chunks)
+            chunk.hash = chunkHash(chunk.text);
+
+        if (!handOver(std::move(chunks), status))
+            return;
+    } while (status == ChunkStreamer::Status::INTERRUPTED);
+}
+
+// Waits for room to hand over a batch. Returns false if the job was cancelled first.
+bool Database::acquireParsedChunkSlot(const IndexingJob &job)
+{
+    QMutexLocker locker(&m_parsedChunkMutex);
+    while (!m_parsedChunkSlots && !job.cancelled)
+        m_parsedChunkSlotFreed.wait(&m_parsedChunkMutex);
+    if (job.cancelled)
+        return false;
+    m_parsedChunkSlots--;
+    return true;
+}
+
+void Database::releaseParsedChunkSlot()
+{
+    QMutexLocker locker(&m_parsedChunkMutex);
+    m_parsedChunkSlots++;
+    m_parsedChunkSlotFreed.wakeOne();
+}
+
+void Database::handleParsedChunks(const std::shared_ptr<IndexingJob> &job, const QList<ChunkStreamer::Chunk> &chunks,
+                                  ChunkStreamer::Status status)
+{
+    m_parsedChunks.emplace_back(job, chunks, status);
+    writeParsedChunks();
+}
+
+// Writes the parsed batches in a single transaction and sends their chunks to the embedder, unless it is already
+// behind, in which case this waits for it to catch up.
+void Database::writeParsedChunks()
+{
+    // enough for the embedder to keep busy while the next batches are written
+    const qsizetype maxEmbeddingBacklog = 8 * s_batchSize;
+    if (m_parsedChunks.empty() || m_embeddingBacklog >= maxEmbeddingBacklog)
+        return;
+
+    // TODO: implement line_from/line_to
+    constexpr int line_from = -1;
+    constexpr int line_to = -1;
+
+    transaction();
+
+    QSqlQuery q(m_db);
+    QVector<EmbeddingResult> reused;
+    while (!m_parsedChunks.empty() && m_embeddingBacklog < maxEmbeddingBacklog) {
+        auto [job, chunks, status] = std::move(m_parsedChunks.front());
+        m_parsedChunks.pop_front();
+        releaseParsedChunkSlot();
+        if (job->cancelled)
+            continue;
+
+        int nChunks = 0;
+        int nAddedWords = 0;
+        for (const auto &chunk : std::as_const(chunks)) {
+            int chunkId = 0;
+            if (!addChunk(q, job->documentId, chunk.text, job->fileName, job->title, job->author, job->subject,
+                          job->keywords, chunk.page, line_from, line_to, chunk.words, chunk.hash, &chunkId)) {
+                qWarning() << "ERROR: Could not insert chunk into db" << q.lastError();
+                continue;
+            }
+
+            nAddedWords += chunk.words;
+            ++nChunks;
+
+            // the same text was already embedded in the previous version of this document
+            if (auto oldChunk = job->oldChunkByHash.constFind(chunk.hash); oldChunk != job->oldChunkByHash.cend()) {
+                std::vector<float> embedding;
+                if (!getChunkEmbedding(q, *oldChunk, job->embeddingModel, embedding))
+                    qWarning() << "ERROR: Could not get embedding of chunk" << q.lastError();
+                if (!embedding.empty()) {
+                    reused.append({ job->embeddingModel, job->folderId, chunkId, std::move(embedding) });
+                    ++m_embeddingBacklog;
+                    continue;
+                }
+            }
+
+            EmbeddingChunk toEmbed;
+            toEmbed.model = job->embeddingModel;
+            toEmbed.folder_id = job->folderId;
+            toEmbed.chunk_id = chunkId;
+            toEmbed.chunk = chunk.text;
+            embedChunk(q, toEmbed, chunk.hash, reused);
+        }
+
+        if (nChunks) {
+            CollectionItem item = guiCollectionItem(job->folderId);
+
+            // Set the start update if we haven't done so already
+            if (item.startUpdate <= item.lastUpdate && item.currentEmbeddingsToIndex == 0)
+                setStartUpdateTime(item);
+
+            item.currentEmbeddingsToIndex += nChunks;
+            item.totalEmbeddingsToIndex += nChunks;
+            item.totalWords += nAddedWords;
+            updateGuiForCollectionItem(item);
+        }
+
+        if (status != ChunkStreamer::Status::INTERRUPTED)
+            finishIndexingJob(*job, status);
     }
 
-    switch (m_chunkStreamer.step()) {
-    case ChunkStreamer::Status::INTERRUPTED:
-        info.currentlyProcessing = true;
-        enqueueDocumentInternal(std::move(info), /*prepend*/ true);
-        return updateFolderToIndex(folder_id, countForFolder + 1);
-    case ChunkStreamer::Status::BINARY_SEEN:
-        /* When we see a binary file, we treat it like an empty file so we know not to
-         * scan it again. All existing chunks are removed, and in-progress embeddings
-         * are ignored when they complete. */
-        qInfo() << "LocalDocs: Ignoring file with binary data:" << document_path;
-
-        // this will also ensure in-flight embeddings are ignored
-        if (!removeChunksByDocumentId(q, existing_id))
-            handleDocumentError("ERROR: Cannot remove chunks of document", existing_id, document_path, q.lastError());
+    commit();
+
+    // stored like new embeddings, once this has returned
+    if (!reused.isEmpty()) {
+        QMetaObject::invokeMethod(this, [this, reused = std::move(reused)] {
+            handleEmbeddingsGenerated(reused);
+        }, Qt::QueuedConnection);
+    }
+}
+
+void Database::finishIndexingJob(const IndexingJob &job, ChunkStreamer::Status status)
+{
+    m_indexingJobs.removeIf([&job](auto &j) { return j.get() == &job; });
+
+    QSqlQuery q(m_db);
+    // whatever the new version did not reuse; an unchanged document keeps all of its chunks
+    if (status != ChunkStreamer::Status::DOC_UNCHANGED && !job.oldChunkIds.isEmpty()) {
+        if (!removeChunksById(q, job.oldChunkIds))
+            handleDocumentError("ERROR: Cannot remove old chunks of document", job.documentId, job.path, q.lastError());
         updateCollectionStatistics();
-        break;
+    }
+
+    switch (status) {
+    case ChunkStreamer::Status::BINARY_SEEN:
+        {
+            /* When we see a binary file, we treat it like an empty file so we know not to
+             * scan it again. All existing chunks are removed, and in-progress embeddings
+             * are ignored when they complete. */
+            qInfo() << "LocalDocs: Ignoring file with binary data:" << job.path;
+
+            // this will also ensure in-flight embeddings are ignored
+            if (!removeChunksByDocumentId(q, job.documentId))
+                handleDocumentError("ERROR: Cannot remove chunks of document", job.documentId, job.path, q.lastError());
+            updateCollectionStatistics();
+            break;
+        }
     case ChunkStreamer::Status::ERROR:
-        qWarning() << "error reading" << document_path;
+        qWarning() << "error reading" << job.path;
         break;
     case ChunkStreamer::Status::DOC_COMPLETE:
+    case ChunkStreamer::Status::DOC_UNCHANGED:
+    case ChunkStreamer::Status::INTERRUPTED:
         ;
     }
 
-dequeue:
+    // a document that could not be read keeps its old document_time, so that it is tried again on the next scan
+    if (status != ChunkStreamer::Status::ERROR && !updateDocument(q, job.documentId, job.documentTime, job.contentHash))
+        handleDocumentError("ERROR: Could not update document_time", job.documentId, job.path, q.lastError());
+
+    removeBytesToIndex(job.folderId, job.size);
+    updateFolderToIndex(job.folderId, countOfDocuments(job.folderId));
+
+    // a worker is free for the next document
+    if (!m_docsToScan.empty())
+        m_scanIntervalTimer->start();
+}
+
+void Database::removeBytesToIndex(int folder_id, qint64 bytes)
+{
     auto item = guiCollectionItem(folder_id);
-    Q_ASSERT(item.currentBytesToIndex >= info.file.size());
-    if (item.currentBytesToIndex < info.file.size()) {
+    Q_ASSERT(item.currentBytesToIndex >= size_t(bytes));
+    if (item.currentBytesToIndex < size_t(bytes)) {
         qWarning() << "Database ERROR: underflow in current bytes to index statistics";
         item.currentBytesToIndex = 0;
     } else {
-        item.currentBytesToIndex -= info.file.size();
+        item.currentBytesToIndex -= bytes;
     }
     updateGuiForCollectionItem(item);
-    return updateFolderToIndex(folder_id, countForFolder);
 }
 
 void Database::scanDocuments(int folder_id, const QString &folder_path)
@@ -1927,6 +2381,7 @@ void Database::start()
     connect(m_embLLM, &EmbeddingLLM::embeddingsGenerated, this, &Database::handleEmbeddingsGenerated);
     connect(m_embLLM, &EmbeddingLLM::errorGenerated, this, &Database::handleErrorGenerated);
     m_scanIntervalTimer->callOnTimeout(this, &Database::scanQueueBatch);
+    m_indexSaveTimer->callOnTimeout(this, &Database::saveEmbeddingIndexes);
 
     const QString modelPath = MySettings::globalInstance()->modelPath();
     QList<CollectionItem> oldCollections;
@@ -1936,7 +2391,19 @@ void Database::start()
     } else if (!initDb(modelPath, oldCollections)) {
         m_databaseValid = false;
     } else {
+        m_indexQuantization = MySettings::globalInstance()->localDocsIndexQuantization();
+        if (!EmbeddingIndex::isValidQuantization(m_indexQuantization)) {
+            qWarning() << "WARNING: unknown embedding index quantization" << m_indexQuantization << "- using i8";
+            m_indexQuantization = u"i8"_s;
+        }
+        QFileInfo dbInfo(m_db.databaseName());
+        m_embeddingIndexDir = u"%1/%2-index"_s.arg(dbInfo.path(), dbInfo.completeBaseName());
+        if (!QDir().mkpath(m_embeddingIndexDir)) {
+            qWarning() << "WARNING: could not create embedding index directory" << m_embeddingIndexDir;
+            m_embeddingIndexDir.clear();
+        }
         cleanDB();
+        openEmbeddingIndexes();
         ftsIntegrityCheck();
         QSqlQuery q(m_db);
         if (!refreshDocumentIdCache(q)) {
@@ -2026,6 +2493,7 @@ void Database::scheduleUncompletedEmbeddings()
         for (; it != end && batch.size() < s_batchSize; ++it)
             batch.append({ /*model*/ it->embedding_model, /*folder_id*/ it->folder_id, /*chunk_id*/ it->chunk_id, /*chunk*/ it->text });
         Q_ASSERT(!batch.isEmpty());
+        m_embeddingBacklog += batch.size();
         m_embLLM->generateDocEmbeddingsAsync(batch);
     }
 }
@@ -2119,6 +2587,7 @@ void Database::forceRebuildFolder(const QString &path)
     }
 
     Q_ASSERT(!m_docsToScan.contains(folder_id));
+    cancelIndexingJobs([folder_id](auto &job) { return job.folderId == folder_id; });
 
     transaction();
 
@@ -2126,6 +2595,7 @@ void Database::forceRebuildFolder(const QString &path)
         qWarning().nospace() << "Database ERROR: Cannot remove chunks for folder " << path << ": " << q.lastError();
         return rollback();
     }
+    m_pendingIndexFolderDrops << folder_id;
 
     commit();
 
@@ -2269,6 +2739,7 @@ bool Database::removeFolderInternal(const QString &collection, int folder_id, co
         qWarning() << "ERROR: Cannot remove folder_id" << folder_id << q.lastError();
         return false;
     }
+    m_pendingIndexFolderDrops << folder_id;
 
     m_collectionMap.remove(folder_id);
     removeFolderFromWatch(path);
@@ -2303,6 +2774,151 @@ void Database::removeFolderFromWatch(const QString &path)
     m_watchedPaths -= QSet(children.begin(), children.end());
 }
 
+QString Database::embeddingIndexPath(const QString &embedding_model, int folder_id) const
+{
+    auto modelHash = QCryptographicHash::hash(embedding_model.toUtf8(), QCryptographicHash::Sha1).toHex().left(16);
+    return u"%1/%2-%3"_s.arg(m_embeddingIndexDir).arg(folder_id).arg(QString::fromLatin1(modelHash));
+}
+
+void Database::openEmbeddingIndexes()
+{
+    if (m_embeddingIndexDir.isEmpty())
+        return;
+
+    QSqlQuery q(m_db);
+    if (!q.exec(SELECT_EMBEDDING_FOLDERS_SQL)) {
+        qWarning() << "Database ERROR: Failed to select embedding folders:" << q.lastError();
+        return;
+    }
+
+    QSet<QString> baseNames;
+    while (q.next()) {
+        QString embedding_model = q.value(0).toString();
+        int folder_id = q.value(1).toInt();
+        baseNames << QFileInfo(embeddingIndexPath(embedding_model, folder_id)).fileName();
+        embeddingIndex(embedding_model, folder_id);
+    }
+
+    // remove the indexes of folders that are gone and any partially written ones
+    const auto entries = QDir(m_embeddingIndexDir).entryInfoList(QDir::Files);
+    for (const auto &entry: entries) {
+        if (!baseNames.contains(entry.completeBaseName()) && !QFile::remove(entry.filePath()))
+            qWarning() << "WARNING: could not remove embedding index" << entry.filePath();
+    }
+}
+
+EmbeddingIndex *Database::embeddingIndex(const QString &embedding_model, int folder_id)
+{
+    if (m_embeddingIndexDir.isEmpty())
+        return nullptr;
+
+    auto &index = m_embeddingIndexes[{ embedding_model, folder_id }];
+    if (!index) {
+        index = std::make_unique<EmbeddingIndex>(embeddingIndexPath(embedding_model, folder_id), m_indexQuantization);
+        index->open();
+    }
+    return index.get();
+}
+
+EmbeddingIndex *Database::verifiedEmbeddingIndex(QSqlQuery &q, const QString &embedding_model, int folder_id)
+{
+    EmbeddingIndex *index = embeddingIndex(embedding_model, folder_id);
+    if (!index || index->isVerified())
+        return index;
+
+    // A saved index can be stale if we did not shut down cleanly, so check that it holds exactly the embeddings in
+    // the database. Once it does, it is kept up to date as embeddings are added and removed.
+    if (!q.prepare(GET_FOLDER_EMBEDDING_IDS_SQL))
+        return nullptr;
+    q.addBindValue(embedding_model);
+    q.addBindValue(folder_id);
+    if (!q.exec()) {
+        qWarning() << "Database ERROR: Failed to exec embedding ids query:" << q.lastError();
+        return nullptr;
+    }
+    size_t nEmbeddings = 0;
+    bool matches = true;
+    while (matches && q.next()) {
+        matches = index->contains(q.value(0).toInt());
+        nEmbeddings++;
+    }
+    if (matches && nEmbeddings == index->size()) {
+        index->setVerified(true);
+        return index;
+    }
+
+    qDebug() << "rebuilding embedding index for folder" << folder_id << "and model" << embedding_model;
+    index->clear();
+    m_indexSaveTimer->start();
+    if (!q.prepare(GET_FOLDER_EMBEDDINGS_SQL))
+        return nullptr;
+    q.addBindValue(embedding_model);
+    q.addBindValue(folder_id);
+    if (!q.exec()) {
+        qWarning() << "Database ERROR: Failed to exec embeddings query:" << q.lastError();
+        return nullptr;
+    }
+    while (q.next()) {
+        QVariant embdCol = q.value(1);
+        if (embdCol.userType() != QMetaType::QByteArray) {
+            qWarning() << "Database ERROR: Expected embedding to be blob, got" << embdCol.userType();
+            return nullptr;
+        }
+        auto *embd = static_cast<const QByteArray *>(embdCol.constData());
+        auto *data = reinterpret_cast<const float *>(embd->constData());
+        if (!index->add(q.value(0).toInt(), data, embd->size() / sizeof(float)))
+            return nullptr;
+    }
+    index->setVerified(true);
+    return index;
+}
+
+bool Database::queueEmbeddingIndexRemovals(QSqlQuery &q, int document_id)
+{
+    if (!q.prepare(SELECT_DOCUMENT_EMBEDDINGS_SQL))
+        return false;
+    q.addBindValue(document_id);
+    if (!q.exec())
+        return false;
+    while (q.next())
+        m_pendingIndexRemovals.append({ q.value(0).toString(), q.value(1).toInt(), q.value(2).toInt() });
+    return true;
+}
+
+void Database::applyEmbeddingIndexChanges(bool verified)
+{
+    for (const auto &[embedding_model, folder_id, chunk_id]: std::as_const(m_pendingIndexRemovals)) {
+        if (m_pendingIndexFolderDrops.contains(folder_id))
+            continue;
+        if (auto *index = embeddingIndex(embedding_model, folder_id)) {
+            index->remove(chunk_id);
+            if (!verified)
+                index->setVerified(false);
+        }
+    }
+    if (!m_pendingIndexRemovals.isEmpty())
+        m_indexSaveTimer->start();
+    m_pendingIndexRemovals.clear();
+
+    for (int folder_id: std::as_const(m_pendingIndexFolderDrops)) {
+        for (auto it = m_embeddingIndexes.begin(); it != m_embeddingIndexes.end();) {
+            if (it->first.second == folder_id) {
+                it->second->discard();
+                it = m_embeddingIndexes.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    m_pendingIndexFolderDrops.clear();
+}
+
+void Database::saveEmbeddingIndexes()
+{
+    for (const auto &[key, index]: m_embeddingIndexes)
+        index->save();
+}
+
 QList<int> Database::searchEmbeddingsHelper(const std::vector<float> &query, QSqlQuery &q, int nNeighbors)
 {
     constexpr int BATCH_SIZE = 2048;
@@ -2310,9 +2926,6 @@ QList<int> Database::searchEmbeddingsHelper(const std::vector<float> &query, QSq
     const int n_embd = query.size();
     const us::metric_punned_t metric(n_embd, us::metric_kind_t::ip_k); // inner product
 
-    us::executor_default_t executor(std::thread::hardware_concurrency());
-    us::exact_search_t search;
-
     QList<int> batchChunkIds;
     QList<float> batchEmbeddings;
     batchChunkIds.reserve(BATCH_SIZE);
@@ -2348,19 +2961,23 @@ QList<int> Database::searchEmbeddingsHelper(const std::vector<float> &query, QSq
         if (!nBatch)
             break;
 
+        // score this batch on the worker pool
+        QList<Result> batchResults(nBatch);
+        auto *queryData = reinterpret_cast<const us::byte_t *>(query.data());
+        WorkerPool::globalInstance()->parallelFor(nBatch, 256, [&](qsizetype begin, qsizetype end) {
+            for (qsizetype i = begin; i < end; i++) {
+                auto *embd = reinterpret_cast<const us::byte_t *>(batchEmbeddings.constData() + i * n_embd);
+                batchResults[i] = { batchChunkIds[i], metric(embd, queryData) };
+            }
+        });
+
         // get top-k nearest neighbors of this batch
         int kBatch = qMin(nNeighbors, nBatch);
-        us::exact_search_results_t batchResults = search(
-            (us::byte_t const *)batchEmbeddings.data(), nBatch, n_embd * sizeof(float),
-            (us::byte_t const *)query.data(),           1,      n_embd * sizeof(float),
-            kBatch, metric
+        std::partial_sort(
+            batchResults.begin(), batchResults.begin() + kBatch, batchResults.end(),
+            [](const Result &a, const Result &b) { return a.dist < b.dist; }
         );
-
-        for (int i = 0; i < kBatch; ++i) {
-            auto offset = batchResults.at(0)[i].offset;
-            us::distance_punned_t distance = batchResults.at(0)[i].distance;
-            results.append({batchChunkIds[offset], distance});
-        }
+        results << batchResults.first(kBatch);
     }
 
     // get top-k nearest neighbors of combined results
@@ -2381,6 +2998,57 @@ QList<int> Database::searchEmbeddings(const std::vector<float> &query, const QLi
     int nNeighbors)
 {
     QSqlQuery q(m_db);
+    if (!q.exec(SELECT_COLLECTION_EMBEDDING_FOLDERS_SQL.arg(collections.join("', '")))) {
+        qWarning() << "Database ERROR: Failed to select embedding folders:" << q.lastError();
+        return {};
+    }
+    QList<std::pair<QString, int>> folders;
+    while (q.next())
+        folders.append({ q.value(0).toString(), q.value(1).toInt() });
+
+    // Distances from a quantized index are approximate, so take more candidates than we need and re-rank them by
+    // their exact distances.
+    int nCandidates = nNeighbors;
+    if (m_indexQuantization == "i8"_L1)
+        nCandidates *= 4;
+    else if (m_indexQuantization == "b1"_L1)
+        nCandidates *= 16;
+
+    // search the HNSW index of each folder and merge the results
+    QList<std::pair<int, float>> results;
+    bool indexed = true;
+    for (const auto &[embedding_model, folder_id]: std::as_const(folders)) {
+        EmbeddingIndex *index = verifiedEmbeddingIndex(q, embedding_model, folder_id);
+        if (!index) {
+            indexed = false;
+            break;
+        }
+        auto candidates = index->search(query, nCandidates);
+        if (m_indexQuantization != "f32"_L1) {
+            QList<int> candidateIds;
+            candidateIds.reserve(candidates.size());
+            for (const auto &[chunkId, distance]: std::as_const(candidates))
+                candidateIds << chunkId;
+            candidates = index->exactDistances(query, candidateIds);
+        }
+        results << candidates;
+    }
+
+    if (indexed) {
+        nNeighbors = qMin(nNeighbors, results.size());
+        std::partial_sort(
+            results.begin(), results.begin() + nNeighbors, results.end(),
+            [](const auto &a, const auto &b) { return a.second < b.second; }
+        );
+
+        QList<int> chunkIds;
+        chunkIds.reserve(nNeighbors);
+        for (int i = 0; i < nNeighbors; i++)
+            chunkIds << results[i].first;
+        return chunkIds;
+    }
+
+    // fall back to scanning every embedding
     if (!q.exec(GET_COLLECTION_EMBEDDINGS_SQL.arg(collections.join("', '")))) {
         qWarning() << "Database ERROR: Failed to exec embeddings query:" << q.lastError();
         return {};
@@ -2388,13 +3056,34 @@ QList<int> Database::searchEmbeddings(const std::vector<float> &query, const QLi
     return searchEmbeddingsHelper(query, q, nNeighbors);
 }
 
-QList<int> Database::scoreChunks(const std::vector<float> &query, const QList<int> &chunks)
+// Only embeddings from the model that embedded the query are comparable with it.
+QList<int> Database::scoreChunks(const std::vector<float> &query, const QString &embedding_model,
+                                 const QList<int> &chunks)
 {
+    // use the embedding matrices of the verified indexes if they hold all of the chunks
+    QHash<int, float> distances;
+    for (const auto &[key, index]: m_embeddingIndexes) {
+        if (key.first != embedding_model || !index->isVerified())
+            continue;
+        for (const auto &[chunkId, distance]: index->exactDistances(query, chunks))
+            distances.insert(chunkId, distance);
+    }
+    if (distances.size() == chunks.size()) {
+        QList<int> chunkIds = chunks;
+        std::sort(chunkIds.begin(), chunkIds.end(), [&](int a, int b) { return distances[a] < distances[b]; });
+        return chunkIds;
+    }
+
     QList<QString> chunkStrings;
     for (int id : chunks)
         chunkStrings << QString::number(id);
     QSqlQuery q(m_db);
-    if (!q.exec(GET_CHUNK_EMBEDDINGS_SQL.arg(chunkStrings.join(", ")))) {
+    if (!q.prepare(GET_CHUNK_EMBEDDINGS_SQL.arg(chunkStrings.join(", ")))) {
+        qWarning() << "Database ERROR: Failed to prepare embeddings query:" << q.lastError();
+        return {};
+    }
+    q.addBindValue(embedding_model);
+    if (!q.exec()) {
         qWarning() << "Database ERROR: Failed to exec embeddings query:" << q.lastError();
         return {};
     }
@@ -2524,8 +3213,8 @@ float Database::computeBM25Weight(const Database::BM25Query &bm25q)
     return bmWeight;
 }
 
-QList<int> Database::reciprocalRankFusion(const std::vector<float> &query, const QList<int> &embeddingResults,
-    const QList<int> &bm25Results, const BM25Query &bm25q, int k)
+QList<int> Database::reciprocalRankFusion(const std::vector<float> &query, const QString &embedding_model,
+    const QList<int> &embeddingResults, const QList<int> &bm25Results, const BM25Query &bm25q, int k)
 {
     // We default to the embedding results and augment with bm25 if any
     QList<int> results = embeddingResults;
@@ -2539,7 +3228,7 @@ QList<int> Database::reciprocalRankFusion(const std::vector<float> &query, const
     }
 
     if (!missingScores.isEmpty()) {
-        QList<int> scored = scoreChunks(query, missingScores);
+        QList<int> scored = scoreChunks(query, embedding_model, missingScores);
         results << scored;
     }
 
@@ -2593,7 +3282,7 @@ QList<int> Database::searchDatabase(const QString &query, const QList<QString> &
     const QList<int> embeddingResults = searchEmbeddings(queryEmbd, collections, k);
     BM25Query bm25q;
     const QList<int> bm25Results = searchBM25(query, collections, bm25q, k);
-    return reciprocalRankFusion(queryEmbd, embeddingResults, bm25Results, bm25q, k);
+    return reciprocalRankFusion(queryEmbd, EmbeddingLLM::model(), embeddingResults, bm25Results, bm25q, k);
 }
 
 void Database::retrieveFromDB(const QList<QString> &collections, const QString &text, int retrievalSize,
@@ -2603,6 +3292,12 @@ void Database::retrieveFromDB(const QList<QString> &collections, const QString &
     qDebug() << "retrieveFromDB" << collections << text << retrievalSize;
 #endif
 
+    QElapsedTimer retrievalTimer;
+    retrievalTimer.start();
+    auto recordLatency = qScopeGuard([&retrievalTimer] {
+        Metrics::globalInstance()->recordRetrieval(retrievalTimer.nsecsElapsed() / 1e9);
+    });
+
     QList<int> searchResults = searchDatabase(text, collections, retrievalSize);
     if (searchResults.isEmpty())
         return;
@@ -2766,6 +3461,9 @@ void Database::changeChunkSize(int chunkSize)
         return;
     }
 
+    // documents that are still being parsed would be chunked with the old size
+    cancelIndexingJobs([](auto &) { return true; });
+
     transaction();
 
     while (q.next()) {
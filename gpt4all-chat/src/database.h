@@ -11,7 +11,9 @@
 #include <QHash>
 #include <QLatin1String>
 #include <QList>
+#include <QMutex>
 #include <QObject>
+#include <QPair>
 #include <QSet>
 #include <QSqlDatabase>
 #include <QString>
@@ -19,14 +21,17 @@
 #include <QThread>
 #include <QUrl>
 #include <QVector>
+#include <QWaitCondition>
 #include <QtGlobal>
 
 #include <atomic>
 #include <cstddef>
+#include <functional>
 #include <list>
 #include <map>
 #include <memory>
 #include <optional>
+#include <tuple>
 #include <utility>
 #include <vector>
 
@@ -34,6 +39,7 @@ using namespace Qt::Literals::StringLiterals;
 
 class Database;
 class DocumentReader;
+class EmbeddingIndex;
 class QFileSystemWatcher;
 class QSqlQuery;
 class QTextStream;
@@ -42,7 +48,7 @@ class QTimer;
 /* Version 0: GPT4All v2.4.3, full-text search
  * Version 1: GPT4All v2.5.3, embeddings in hsnwlib
  * Version 2: GPT4All v3.0.0, embeddings in sqlite
- * Version 3: GPT4All v3.4.0, hybrid search
+ * Version 3: GPT4All v3.4.0, hybrid search; content hashes of documents and chunks were added later, in place
  */
 
 // minimum supported version
@@ -64,7 +70,6 @@ struct DocumentInfo
 
     int       folder;
     QFileInfo file;
-    bool      currentlyProcessing = false;
 
     key_type key() const { return {folder, file.canonicalFilePath()}; } // for comparison
 
@@ -164,29 +169,30 @@ struct CollectionItem {
 };
 Q_DECLARE_METATYPE(CollectionItem)
 
+// Splits a document into chunks of at most maxChunkSize characters. Independent of the database, so that documents
+// can be parsed on worker threads.
 class ChunkStreamer {
 public:
-    enum class Status { DOC_COMPLETE, INTERRUPTED, ERROR, BINARY_SEEN };
+    enum class Status { DOC_COMPLETE, INTERRUPTED, ERROR, BINARY_SEEN, DOC_UNCHANGED };
+    struct Chunk {
+        QString    text;
+        int        page;
+        int        words;
+        QByteArray hash; // of the text, set by the worker
+    };
 
-    explicit ChunkStreamer(Database *database);
+    // throws std::runtime_error if the document cannot be opened
+    ChunkStreamer(const DocumentInfo &doc, int maxChunkSize);
     ~ChunkStreamer();
 
-    void setDocument(const DocumentInfo &doc, int documentId, const QString &embeddingModel);
-    std::optional<DocumentInfo::key_type> currentDocKey() const;
-    void reset();
+    const DocumentReader &reader() const;
 
-    Status step();
+    // Appends up to maxChunks chunks. Returns INTERRUPTED if there are more to come.
+    Status step(QList<Chunk> &chunks, int maxChunks);
 
 private:
-    Database                              *m_database;
-    std::optional<DocumentInfo::key_type>  m_docKey;
-    std::unique_ptr<DocumentReader>        m_reader; // may be invalid, always compare key first
-    int                                    m_documentId;
-    QString                                m_embeddingModel;
-    QString                                m_title;
-    QString                                m_author;
-    QString                                m_subject;
-    QString                                m_keywords;
+    std::unique_ptr<DocumentReader>        m_reader;
+    int                                    m_maxChunkSize;
 
     // working state
     QString                                m_chunk; // has a trailing space for convenience
@@ -194,6 +200,34 @@ private:
     int                                    m_page = 0;
 };
 
+// A document being indexed. It is parsed and chunked by a worker thread, which hands its chunks in batches to the
+// database thread to be written and embedded.
+struct IndexingJob {
+    int               folderId;
+    int               documentId;
+    QString           path; // canonical
+    QString           fileName;
+    qint64            size;
+    QString           embeddingModel;
+    int               chunkSize;
+    qint64            documentTime;
+
+    // what the document had when it was last indexed: its embeddings are reused for chunks with the same text, and
+    // the rest are removed once the document is done
+    QByteArray        oldContentHash;
+    QList<int>        oldChunkIds;
+    QHash<QByteArray, int> oldChunkByHash;
+
+    // set by the worker before it hands over its first batch
+    QByteArray        contentHash;
+    QString           title;
+    QString           author;
+    QString           subject;
+    QString           keywords;
+
+    std::atomic<bool> cancelled = false;
+};
+
 class Database : public QObject
 {
     Q_OBJECT
@@ -237,34 +271,53 @@ private:
 
     bool addChunk(QSqlQuery &q, int document_id, const QString &chunk_text, const QString &file,
                   const QString &title, const QString &author, const QString &subject, const QString &keywords,
-                  int page, int from, int to, int words, int *chunk_id);
+                  int page, int from, int to, int words, const QByteArray &hash, int *chunk_id);
     bool refreshDocumentIdCache(QSqlQuery &q);
     bool removeChunksByDocumentId(QSqlQuery &q, int document_id);
+    bool removeChunksById(QSqlQuery &q, const QList<int> &chunk_ids);
     bool sqlRemoveDocsByFolderPath(QSqlQuery &q, const QString &path);
     bool hasContent();
     // not found -> 0, , exists and has content -> 1, error -> -1
     int openDatabase(const QString &modelPath, bool create = true, int ver = LOCALDOCS_VERSION);
     bool openLatestDb(const QString &modelPath, QList<CollectionItem> &oldCollections);
     bool initDb(const QString &modelPath, const QList<CollectionItem> &oldCollections);
+    bool addContentHashColumns();
     int checkAndAddFolderToDB(const QString &path);
     bool removeFolderInternal(const QString &collection, int folder_id, const QString &path);
     size_t chunkStream(QTextStream &stream, int folder_id, int document_id, const QString &embedding_model,
         const QString &file, const QString &title, const QString &author, const QString &subject,
         const QString &keywords, int page, int maxChunks = -1);
     void appendChunk(const EmbeddingChunk &chunk);
+    void embedChunk(QSqlQuery &q, const EmbeddingChunk &chunk, const QByteArray &hash,
+                    QVector<EmbeddingResult> &reused);
     void sendChunkList();
     void updateFolderToIndex(int folder_id, size_t countForFolder, bool sendChunks = true);
     size_t countOfDocuments(int folder_id) const;
     size_t countOfBytes(int folder_id) const;
     DocumentInfo dequeueDocument();
     void removeFolderFromDocumentQueue(int folder_id);
-    void enqueueDocumentInternal(DocumentInfo &&info, bool prepend = false);
     void enqueueDocuments(int folder_id, std::list<DocumentInfo> &&infos);
     void scanQueue();
+    void parseDocument(const std::shared_ptr<IndexingJob> &job);
+    bool acquireParsedChunkSlot(const IndexingJob &job);
+    void releaseParsedChunkSlot();
+    void handleParsedChunks(const std::shared_ptr<IndexingJob> &job, const QList<ChunkStreamer::Chunk> &chunks,
+                            ChunkStreamer::Status status);
+    void writeParsedChunks();
+    void finishIndexingJob(const IndexingJob &job, ChunkStreamer::Status status);
+    void cancelIndexingJobs(const std::function<bool(const IndexingJob &)> &matches);
+    void removeBytesToIndex(int folder_id, qint64 bytes);
     bool ftsIntegrityCheck();
     bool cleanDB();
     void addFolderToWatch(const QString &path);
     void removeFolderFromWatch(const QString &path);
+    QString embeddingIndexPath(const QString &embedding_model, int folder_id) const;
+    void openEmbeddingIndexes();
+    EmbeddingIndex *embeddingIndex(const QString &embedding_model, int folder_id);
+    EmbeddingIndex *verifiedEmbeddingIndex(QSqlQuery &q, const QString &embedding_model, int folder_id);
+    bool queueEmbeddingIndexRemovals(QSqlQuery &q, int document_id);
+    void applyEmbeddingIndexChanges(bool verified = true);
+    void saveEmbeddingIndexes();
     static QList<int> searchEmbeddingsHelper(const std::vector<float> &query, QSqlQuery &q, int nNeighbors);
     QList<int> searchEmbeddings(const std::vector<float> &query, const QList<QString> &collections,
         int nNeighbors);
@@ -278,10 +331,10 @@ private:
     };
     QList<Database::BM25Query> queriesForFTS5(const QString &input);
     QList<int> searchBM25(const QString &query, const QList<QString> &collections, BM25Query &bm25q, int k);
-    QList<int> scoreChunks(const std::vector<float> &query, const QList<int> &chunks);
+    QList<int> scoreChunks(const std::vector<float> &query, const QString &embedding_model, const QList<int> &chunks);
     float computeBM25Weight(const BM25Query &bm25q);
-    QList<int> reciprocalRankFusion(const std::vector<float> &query, const QList<int> &embeddingResults,
-        const QList<int> &bm25Results, const BM25Query &bm25q, int k);
+    QList<int> reciprocalRankFusion(const std::vector<float> &query, const QString &embedding_model,
+        const QList<int> &embeddingResults, const QList<int> &bm25Results, const BM25Query &bm25q, int k);
     QList<int> searchDatabase(const QString &query, const QList<QString> &collections, int k);
 
     void setStartUpdateTime(CollectionItem &item);
@@ -310,10 +363,25 @@ private:
     QVector<EmbeddingChunk> m_chunkList;
     QHash<int, CollectionItem> m_collectionMap; // used only for tracking indexing/embedding progress
     std::atomic<bool> m_databaseValid;
-    ChunkStreamer m_chunkStreamer;
+    QList<std::shared_ptr<IndexingJob>> m_indexingJobs; // documents being parsed on the worker pool
+    // parsed batches waiting to be written, bounded by m_parsedChunkSlots
+    std::list<std::tuple<std::shared_ptr<IndexingJob>, QList<ChunkStreamer::Chunk>, ChunkStreamer::Status>>
+        m_parsedChunks;
+    QMutex m_parsedChunkMutex; // guards m_parsedChunkSlots
+    QWaitCondition m_parsedChunkSlotFreed; // also woken when jobs are cancelled
+    int m_parsedChunkSlots = 16; // batches the workers may still hand over
+    qsizetype m_embeddingBacklog = 0; // chunks sent to the embedder that have not come back yet
+    // (model, text hash) -> chunks waiting for the embedding of a chunk with the same text
+    QHash<QPair<QString, QByteArray>, QList<EmbeddingChunk>> m_duplicateChunks;
+    QHash<int, QByteArray> m_embeddingChunkHashes; // chunk id -> text hash, for the chunks they are waiting for
     QSet<int> m_documentIdCache; // cached list of documents with chunks for fast lookup
-
-    friend class ChunkStreamer;
+    QString m_embeddingIndexDir;
+    QString m_indexQuantization;
+    std::map<std::pair<QString, int>, std::unique_ptr<EmbeddingIndex>> m_embeddingIndexes; // by (model, folder_id)
+    QList<std::tuple<QString, int, int>> m_pendingIndexRemovals; // (model, folder_id, chunk_id), applied on commit
+    QSet<int> m_pendingIndexFolderDrops; // folder ids, applied on commit
+    bool m_inTransaction = false;
+    QTimer *m_indexSaveTimer;
 };
 
 #endif // DATABASE_H
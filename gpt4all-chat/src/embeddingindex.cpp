@@ -0,0 +1,371 @@
+#include "embeddingindex.h"
+
+#include <QByteArray>
+#include <QDebug>
+#include <QFileInfo>
+#include <QIODevice>
+#include <QSaveFile>
+#include <QtLogging>
+
+#include <algorithm>
+#include <cstring>
+
+using namespace Qt::Literals::StringLiterals;
+namespace us = unum::usearch;
+
+
+namespace {
+    // start of the matrix file, padded to MATRIX_ALIGNMENT
+    struct MatrixHeader {
+        quint32 magic;
+        quint32 version;
+        quint32 dimensions;
+        quint32 count;
+    };
+} // namespace
+
+static constexpr quint32 MATRIX_MAGIC     = 0x584D4D45;
+static constexpr quint32 MATRIX_VERSION   = 1;
+static constexpr qint64  MATRIX_ALIGNMENT = 64;
+
+static qint64 alignMatrixOffset(qint64 offset)
+{
+    return (offset + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+}
+
+static qint64 matrixRowsOffset(size_t count)
+{
+    return MATRIX_ALIGNMENT + alignMatrixOffset(qint64(count * sizeof(qint32)));
+}
+
+// usearch raises unhandled errors when they are destroyed, so every error we look at must be released
+static QString takeError(us::error_t &error)
+{
+    return QString::fromUtf8(error.release());
+}
+
+EmbeddingIndex::EmbeddingIndex(const QString &basePath, const QString &quantization)
+    : m_hnswPath(basePath + u".usearch"_s)
+    , m_matrixPath(basePath + u".matrix"_s)
+{
+    Q_ASSERT(isValidQuantization(quantization));
+    if (quantization == "b1"_L1) {
+        // the sign of each dimension, compared by the number of differing bits
+        m_scalarKind = us::scalar_kind_t::b1x8_k;
+        m_metricKind = us::metric_kind_t::hamming_k;
+    } else {
+        m_scalarKind = quantization == "i8"_L1 ? us::scalar_kind_t::i8_k : us::scalar_kind_t::f32_k;
+        m_metricKind = us::metric_kind_t::ip_k; // inner product
+    }
+}
+
+bool EmbeddingIndex::isValidQuantization(const QString &quantization)
+{
+    return quantization == "f32"_L1 || quantization == "i8"_L1 || quantization == "b1"_L1;
+}
+
+bool EmbeddingIndex::open()
+{
+    reset();
+    if (!QFileInfo::exists(m_hnswPath) || !QFileInfo::exists(m_matrixPath))
+        return false;
+
+    auto made = Index::make(QFile::encodeName(m_hnswPath).constData(), /*view*/ true);
+    if (!made) {
+        qWarning() << "WARNING: could not open embedding index" << m_hnswPath << takeError(made.error);
+        return false;
+    }
+    if (made.index.scalar_kind() != m_scalarKind) {
+        // saved with a different quantization, so it will be rebuilt
+        return false;
+    }
+    if (!openMatrix() || made.index.size() != m_count || made.index.dimensions() != m_dimensions) {
+        reset();
+        return false;
+    }
+
+    m_index.emplace(std::move(made.index));
+    m_viewed   = true;
+    m_dirty    = false;
+    m_verified = false;
+    return true;
+}
+
+bool EmbeddingIndex::openMatrix()
+{
+    m_matrixFile.setFileName(m_matrixPath);
+    if (!m_matrixFile.open(QIODevice::ReadOnly)) {
+        qWarning() << "WARNING: could not open embedding matrix" << m_matrixPath << m_matrixFile.errorString();
+        return false;
+    }
+
+    MatrixHeader header;
+    const qint64 fileSize = m_matrixFile.size();
+    if (m_matrixFile.read(reinterpret_cast<char *>(&header), sizeof header) != sizeof header
+        || header.magic != MATRIX_MAGIC || header.version != MATRIX_VERSION
+        || fileSize != matrixRowsOffset(header.count) + qint64(header.count) * header.dimensions * sizeof(float)) {
+        qWarning() << "WARNING: ignoring invalid embedding matrix" << m_matrixPath;
+        m_matrixFile.close();
+        return false;
+    }
+
+    m_matrixMap = m_matrixFile.map(0, fileSize);
+    if (!m_matrixMap) {
+        qWarning() << "WARNING: could not map embedding matrix" << m_matrixPath << m_matrixFile.errorString();
+        m_matrixFile.close();
+        return false;
+    }
+
+    m_chunkIds   = reinterpret_cast<const qint32 *>(m_matrixMap + MATRIX_ALIGNMENT);
+    m_rows       = reinterpret_cast<const float *>(m_matrixMap + matrixRowsOffset(header.count));
+    m_count      = header.count;
+    m_dimensions = header.dimensions;
+    m_rowOfChunk.reserve(m_count);
+    for (size_t i = 0; i < m_count; i++)
+        m_rowOfChunk.insert(m_chunkIds[i], i);
+    return true;
+}
+
+bool EmbeddingIndex::makeWritable()
+{
+    if (!m_viewed)
+        return true;
+
+    // a memory-mapped index is read-only, so load a copy of it
+    auto made = Index::make(QFile::encodeName(m_hnswPath).constData(), /*view*/ false);
+    if (!made) {
+        qWarning() << "WARNING: could not load embedding index" << m_hnswPath << takeError(made.error);
+        reset();
+        m_verified = false;
+        return false;
+    }
+    m_index.emplace(std::move(made.index));
+
+    m_ownChunkIds.assign(m_chunkIds, m_chunkIds + m_count);
+    m_ownRows.assign(m_rows, m_rows + m_count * m_dimensions);
+    m_matrixFile.unmap(m_matrixMap);
+    m_matrixMap = nullptr;
+    m_matrixFile.close();
+    updateMatrixPointers();
+
+    m_viewed = false;
+    return true;
+}
+
+void EmbeddingIndex::reset()
+{
+    m_index.reset();
+    if (m_matrixMap) {
+        m_matrixFile.unmap(m_matrixMap);
+        m_matrixMap = nullptr;
+    }
+    m_matrixFile.close();
+    m_ownChunkIds.clear();
+    m_ownRows.clear();
+    m_chunkIds   = nullptr;
+    m_rows       = nullptr;
+    m_count      = 0;
+    m_dimensions = 0;
+    m_rowOfChunk.clear();
+    m_viewed     = false;
+}
+
+void EmbeddingIndex::updateMatrixPointers()
+{
+    m_chunkIds = m_ownChunkIds.data();
+    m_rows     = m_ownRows.data();
+    m_count    = m_ownChunkIds.size();
+}
+
+bool EmbeddingIndex::add(int chunkId, const float *embedding, size_t dimensions)
+{
+    if (!makeWritable())
+        return false;
+
+    if (!m_index) {
+        auto made = Index::make(us::metric_punned_t(dimensions, m_metricKind, m_scalarKind));
+        if (!made) {
+            qWarning() << "WARNING: could not create embedding index" << m_hnswPath << takeError(made.error);
+            return false;
+        }
+        m_index.emplace(std::move(made.index));
+        m_dimensions = dimensions;
+    } else if (m_dimensions != dimensions) {
+        qWarning() << "WARNING: expected embedding to have" << m_dimensions << "dimensions, got" << dimensions;
+        return false;
+    }
+
+    if (m_index->contains(chunkId)) {
+        auto removed = m_index->remove(chunkId);
+        if (removed.error)
+            qWarning() << "WARNING: could not replace embedding in index" << m_hnswPath << takeError(removed.error);
+    }
+
+    if (m_index->size() >= m_index->capacity()
+        && !m_index->reserve(us::index_limits_t(std::max<size_t>(m_index->capacity() * 2, 1024), 1))) {
+        qWarning() << "WARNING: could not grow embedding index" << m_hnswPath;
+        return false;
+    }
+
+    auto added = m_index->add(chunkId, embedding);
+    if (!added) {
+        qWarning() << "WARNING: could not add embedding to index" << m_hnswPath << takeError(added.error);
+        return false;
+    }
+
+    if (auto it = m_rowOfChunk.constFind(chunkId); it != m_rowOfChunk.cend()) {
+        std::copy_n(embedding, dimensions, m_ownRows.begin() + *it * dimensions);
+    } else {
+        m_rowOfChunk.insert(chunkId, m_ownChunkIds.size());
+        m_ownChunkIds.push_back(chunkId);
+        m_ownRows.insert(m_ownRows.end(), embedding, embedding + dimensions);
+    }
+    updateMatrixPointers();
+    m_dirty = true;
+    return true;
+}
+
+void EmbeddingIndex::remove(int chunkId)
+{
+    if (!contains(chunkId) || !makeWritable())
+        return;
+
+    if (m_index->contains(chunkId)) {
+        auto removed = m_index->remove(chunkId);
+        if (removed.error) {
+            qWarning() << "WARNING: could not remove embedding from index" << m_hnswPath << takeError(removed.error);
+            m_verified = false;
+        }
+    }
+
+    // move the last row into the gap
+    const size_t i = m_rowOfChunk.take(chunkId);
+    const size_t last = m_ownChunkIds.size() - 1;
+    if (i != last) {
+        m_ownChunkIds[i] = m_ownChunkIds[last];
+        std::copy_n(m_ownRows.begin() + last * m_dimensions, m_dimensions, m_ownRows.begin() + i * m_dimensions);
+        m_rowOfChunk[m_ownChunkIds[i]] = i;
+    }
+    m_ownChunkIds.pop_back();
+    m_ownRows.resize(last * m_dimensions);
+    updateMatrixPointers();
+    m_dirty = true;
+}
+
+void EmbeddingIndex::clear()
+{
+    reset();
+    m_dirty = true;
+}
+
+QList<std::pair<int, float>> EmbeddingIndex::search(const std::vector<float> &query, int k) const
+{
+    if (!m_index || !m_count || k <= 0)
+        return {};
+    if (m_dimensions != query.size()) {
+        qWarning() << "WARNING: expected query to have" << m_dimensions << "dimensions, got" << query.size();
+        return {};
+    }
+
+    auto result = m_index->search(query.data(), k);
+    if (!result) {
+        qWarning() << "WARNING: could not search embedding index" << m_hnswPath << takeError(result.error);
+        return {};
+    }
+
+    std::vector<Index::vector_key_t> keys(k);
+    std::vector<Index::distance_t> distances(k);
+    size_t found = result.dump_to(keys.data(), distances.data());
+
+    QList<std::pair<int, float>> matches;
+    matches.reserve(found);
+    for (size_t i = 0; i < found; i++)
+        matches.append({ int(keys[i]), float(distances[i]) });
+    return matches;
+}
+
+QList<std::pair<int, float>> EmbeddingIndex::exactDistances(const std::vector<float> &query,
+                                                            const QList<int> &chunkIds) const
+{
+    if (!m_count || m_dimensions != query.size())
+        return {};
+
+    const us::metric_punned_t metric(m_dimensions, us::metric_kind_t::ip_k); // inner product
+    QList<std::pair<int, float>> distances;
+    distances.reserve(chunkIds.size());
+    for (int chunkId: chunkIds) {
+        auto it = m_rowOfChunk.constFind(chunkId);
+        if (it == m_rowOfChunk.cend())
+            continue;
+        us::distance_punned_t distance = metric(reinterpret_cast<const us::byte_t *>(row(*it)),
+                                                reinterpret_cast<const us::byte_t *>(query.data()));
+        distances.append({ chunkId, float(distance) });
+    }
+    return distances;
+}
+
+bool EmbeddingIndex::saveMatrix()
+{
+    QSaveFile file(m_matrixPath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "WARNING: could not save embedding matrix" << m_matrixPath << file.errorString();
+        return false;
+    }
+
+    QByteArray header(MATRIX_ALIGNMENT, '\0');
+    const MatrixHeader fields { MATRIX_MAGIC, MATRIX_VERSION, quint32(m_dimensions), quint32(m_count) };
+    memcpy(header.data(), &fields, sizeof fields);
+    const qint64 idsSize = m_count * sizeof(qint32);
+    const QByteArray padding(matrixRowsOffset(m_count) - MATRIX_ALIGNMENT - idsSize, '\0');
+    const qint64 rowsSize = m_count * m_dimensions * sizeof(float);
+
+    bool ok = file.write(header) == header.size()
+        && file.write(reinterpret_cast<const char *>(m_chunkIds), idsSize) == idsSize
+        && file.write(padding) == padding.size()
+        && file.write(reinterpret_cast<const char *>(m_rows), rowsSize) == rowsSize
+        && file.commit();
+    if (!ok)
+        qWarning() << "WARNING: could not save embedding matrix" << m_matrixPath << file.errorString();
+    return ok;
+}
+
+bool EmbeddingIndex::save()
+{
+    if (!m_dirty)
+        return true;
+
+    if (!m_count) {
+        discard();
+        return true;
+    }
+
+    Q_ASSERT(!m_viewed); // only a copy in memory can have changes
+    if (!saveMatrix())
+        return false;
+
+    // write a copy and swap it in, so a crash cannot leave a truncated index behind
+    const QString tempPath = m_hnswPath + u".tmp"_s;
+    auto saved = m_index->save(QFile::encodeName(tempPath).constData());
+    if (!saved) {
+        qWarning() << "WARNING: could not save embedding index" << tempPath << takeError(saved.error);
+        QFile::remove(tempPath);
+        return false;
+    }
+    QFile::remove(m_hnswPath);
+    if (!QFile::rename(tempPath, m_hnswPath)) {
+        qWarning() << "WARNING: could not replace embedding index" << m_hnswPath;
+        return false;
+    }
+    m_dirty = false;
+    return true;
+}
+
+void EmbeddingIndex::discard()
+{
+    reset();
+    m_dirty = false;
+    for (const auto &path: { m_hnswPath, m_matrixPath }) {
+        if (QFileInfo::exists(path) && !QFile::remove(path))
+            qWarning() << "WARNING: could not remove embedding index" << path;
+    }
+}
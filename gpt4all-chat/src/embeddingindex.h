@@ -0,0 +1,89 @@
+#ifndef EMBEDDINGINDEX_H
+#define EMBEDDINGINDEX_H
+
+#include <usearch/index_dense.hpp>
+
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QtGlobal>
+
+#include <cstddef>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// Approximate nearest neighbor (HNSW) index over the embeddings of one LocalDocs folder for one embedding model,
+// saved next to the database so that retrieval does not have to scan every embedding. The embeddings table stays the
+// source of truth; the database verifies an index against it before trusting it and rebuilds it if they disagree.
+// Not thread-safe: it is only used from the database thread.
+//
+// The index can store its vectors quantized to reduce its size in memory and on disk: "i8" (4x smaller) or "b1" (one
+// bit per dimension, 32x smaller). Distances from a quantized index are approximate, so its results should be treated
+// as candidates and re-ranked by their exact distances.
+//
+// The exact distances come from a matrix of the float embeddings that is saved alongside the HNSW index: a header, the
+// chunk ids, then one row per embedding, each section aligned to 64 bytes so it can be used straight from the mapped
+// file.
+class EmbeddingIndex
+{
+public:
+    // basePath is the path of the index files without their extension
+    EmbeddingIndex(const QString &basePath, const QString &quantization);
+
+    static bool isValidQuantization(const QString &quantization);
+
+    // Memory-maps the saved index, if there is one. It is copied into memory the first time it is modified.
+    bool open();
+
+    bool add(int chunkId, const float *embedding, size_t dimensions);
+    void remove(int chunkId);
+    void clear();
+
+    bool contains(int chunkId) const { return m_rowOfChunk.contains(chunkId); }
+    size_t size() const { return m_count; }
+    // (chunk id, distance) pairs, nearest first
+    QList<std::pair<int, float>> search(const std::vector<float> &query, int k) const;
+    // (chunk id, exact distance) pairs for the given chunks that are in this index, in no particular order
+    QList<std::pair<int, float>> exactDistances(const std::vector<float> &query, const QList<int> &chunkIds) const;
+
+    bool isVerified() const { return m_verified; }
+    void setVerified(bool verified) { m_verified = verified; }
+
+    bool save();
+    void discard();
+
+private:
+    bool openMatrix();
+    bool saveMatrix();
+    bool makeWritable();
+    void reset();
+    void updateMatrixPointers();
+    const float *row(size_t i) const { return m_rows + i * m_dimensions; }
+
+    using Index = unum::usearch::index_dense_t;
+
+    QString                       m_hnswPath;
+    QString                       m_matrixPath;
+    unum::usearch::scalar_kind_t  m_scalarKind;
+    unum::usearch::metric_kind_t  m_metricKind;
+    std::optional<Index>          m_index;
+
+    // the matrix, either mapped from m_matrixFile or held in m_ownChunkIds/m_ownRows once it has been modified
+    QFile                         m_matrixFile;
+    uchar                        *m_matrixMap  = nullptr;
+    std::vector<qint32>           m_ownChunkIds;
+    std::vector<float>            m_ownRows;
+    const qint32                 *m_chunkIds   = nullptr;
+    const float                  *m_rows       = nullptr;
+    size_t                        m_count      = 0;
+    size_t                        m_dimensions = 0;
+    QHash<int, size_t>            m_rowOfChunk;
+
+    bool                          m_viewed   = false;
+    bool                          m_dirty    = false;
+    bool                          m_verified = false;
+};
+
+#endif // EMBEDDINGINDEX_H
@@ -6,10 +6,11 @@
 #include <gpt4all-backend/llmodel.h>
 
 #include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDataStream>
 #include <QDebug>
 #include <QFile>
 #include <QFileInfo>
-#include <QGuiApplication>
 #include <QIODevice>
 #include <QJsonArray>
 #include <QJsonDocument>
@@ -19,12 +20,17 @@
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
 #include <QNetworkRequest>
+#include <QSaveFile>
+#include <QSemaphore>
 #include <QUrl>
 #include <Qt>
 #include <QtGlobal>
 #include <QtLogging>
 
+#include <algorithm>
 #include <exception>
+#include <functional>
+#include <numeric>
 #include <utility>
 #include <vector>
 
@@ -32,6 +38,11 @@ using namespace Qt::Literals::StringLiterals;
 
 static const QString EMBEDDING_MODEL_NAME = u"nomic-embed-text-v1.5"_s;
 static const QString LOCAL_EMBEDDING_MODEL = u"nomic-embed-text-v1.5.f16.gguf"_s;
+static const QString ATLAS_EMBEDDING_MODEL = u"nomic-embed-text-v1"_s;
+
+static constexpr int     QUERY_CACHE_SIZE    = 512; // entries
+static constexpr quint32 QUERY_CACHE_MAGIC   = 0x51454D42;
+static constexpr qint32  QUERY_CACHE_VERSION = 1;
 
 EmbeddingLLMWorker::EmbeddingLLMWorker()
     : QObject(nullptr)
@@ -43,6 +54,7 @@ EmbeddingLLMWorker::EmbeddingLLMWorker()
     connect(this, &EmbeddingLLMWorker::finished, &m_workerThread, &QThread::quit, Qt::DirectConnection);
     m_workerThread.setObjectName("embedding");
     m_workerThread.start();
+    m_extraModelThreads.setExpiryTimeout(-1);
 }
 
 EmbeddingLLMWorker::~EmbeddingLLMWorker()
@@ -55,6 +67,7 @@ EmbeddingLLMWorker::~EmbeddingLLMWorker()
         delete m_model;
         m_model = nullptr;
     }
+    qDeleteAll(m_extraModels);
 }
 
 void EmbeddingLLMWorker::wait()
@@ -66,13 +79,17 @@ bool EmbeddingLLMWorker::loadModel()
 {
     constexpr int n_ctx = 2048;
 
+    setQueryModelId({});
     m_nomicAPIKey.clear();
     m_model = nullptr;
+    qDeleteAll(m_extraModels);
+    m_extraModels.clear();
 
     // TODO(jared): react to setting changes without restarting
 
     if (MySettings::globalInstance()->localDocsUseRemoteEmbed()) {
         m_nomicAPIKey = MySettings::globalInstance()->localDocsNomicAPIKey();
+        setQueryModelId(u"atlas/%1"_s.arg(ATLAS_EMBEDDING_MODEL));
         return true;
     }
 
@@ -173,9 +190,48 @@ bool EmbeddingLLMWorker::loadModel()
     int n_threads = MySettings::globalInstance()->threadCount();
     m_model->setThreadCount(n_threads);
 
+    // More contexts for indexing on the CPU, each with its own threads. They are loaded from the same file, which is
+    // memory-mapped, so they share its weights; each one adds only its own buffers.
+    if (actualDeviceIsCPU) {
+        int nContexts = MySettings::globalInstance()->localDocsEmbeddingContexts();
+        if (nContexts <= 0)
+            nContexts = std::max(1, QThread::idealThreadCount() / std::max(n_threads, 1));
+        std::string cpuBackend = backend == "cuda" ? "auto" : backend;
+        for (int i = 1; i < nContexts; i++) {
+            LLModel *model;
+            try {
+                model = LLModel::Implementation::construct(filePath.toStdString(), cpuBackend, n_ctx);
+            } catch (const std::exception &e) {
+                qWarning() << "embllm WARNING: Could not create another embedding context:" << e.what();
+                break;
+            }
+            if (!model->loadModel(filePath.toStdString(), n_ctx, 0)) {
+                qWarning() << "embllm WARNING: Could not create another embedding context";
+                delete model;
+                break;
+            }
+            model->setThreadCount(n_threads);
+            m_extraModels << model;
+        }
+        m_extraModelThreads.setMaxThreadCount(std::max<qsizetype>(m_extraModels.size(), 1));
+    }
+
+    setQueryModelId(LOCAL_EMBEDDING_MODEL);
     return true;
 }
 
+QString EmbeddingLLMWorker::queryModelId() const
+{
+    QMutexLocker locker(&m_modelIdMutex);
+    return m_modelId;
+}
+
+void EmbeddingLLMWorker::setQueryModelId(const QString &modelId)
+{
+    QMutexLocker locker(&m_modelIdMutex);
+    m_modelId = modelId;
+}
+
 std::vector<float> EmbeddingLLMWorker::generateQueryEmbedding(const QString &text)
 {
     {
@@ -209,7 +265,7 @@ std::vector<float> EmbeddingLLMWorker::generateQueryEmbedding(const QString &tex
 void EmbeddingLLMWorker::sendAtlasRequest(const QStringList &texts, const QString &taskType, const QVariant &userData)
 {
     QJsonObject root;
-    root.insert("model", "nomic-embed-text-v1");
+    root.insert("model", ATLAS_EMBEDDING_MODEL);
     root.insert("texts", QJsonArray::fromStringList(texts));
     root.insert("task_type", taskType);
 
@@ -222,7 +278,7 @@ void EmbeddingLLMWorker::sendAtlasRequest(const QStringList &texts, const QStrin
     request.setRawHeader("Authorization", authorization.toUtf8());
     request.setAttribute(QNetworkRequest::User, userData);
     QNetworkReply *reply = m_networkManager->post(request, doc.toJson(QJsonDocument::Compact));
-    connect(qGuiApp, &QCoreApplication::aboutToQuit, reply, &QNetworkReply::abort);
+    connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, reply, &QNetworkReply::abort);
     connect(reply, &QNetworkReply::finished, this, &EmbeddingLLMWorker::handleFinished);
 }
 
@@ -248,7 +304,7 @@ void EmbeddingLLMWorker::atlasQueryEmbeddingRequested(const QString &text)
 
 void EmbeddingLLMWorker::docEmbeddingsRequested(const QVector<EmbeddingChunk> &chunks)
 {
-    if (m_stopGenerating)
+    if (m_stopGenerating || chunks.isEmpty())
         return;
 
     bool isNomic;
@@ -256,6 +312,7 @@ void EmbeddingLLMWorker::docEmbeddingsRequested(const QVector<EmbeddingChunk> &c
         QMutexLocker locker(&m_mutex);
         if (!hasModel() && !loadModel()) {
             qWarning() << "WARNING: Could not load model for embeddings";
+            emit errorGenerated(chunks, u"ERROR: Could not load the embedding model"_s);
             return;
         }
 
@@ -263,35 +320,58 @@ void EmbeddingLLMWorker::docEmbeddingsRequested(const QVector<EmbeddingChunk> &c
     }
 
     if (!isNomic) {
-        QVector<EmbeddingResult> results;
-        results.reserve(chunks.size());
-        std::vector<std::string> texts;
-        texts.reserve(chunks.size());
-        for (const auto &c: chunks) {
-            EmbeddingResult result;
-            result.model = c.model;
-            result.folder_id = c.folder_id;
-            result.chunk_id = c.chunk_id;
-            result.embedding.resize(m_model->embeddingSize());
-            results << result;
-            texts.push_back(c.chunk.toStdString());
+        // Embed the whole request at once, which packs as many texts into each batch as the context holds, instead of
+        // decoding a few texts at a time. Sorting the texts by length keeps those batches evenly filled. With several
+        // contexts, each one takes every Nth text, so that they all get a similar share of long and short texts.
+        std::vector<qsizetype> order(chunks.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::ranges::stable_sort(order, std::greater(), [&chunks](qsizetype i) { return chunks[i].chunk.size(); });
+
+        QVector<EmbeddingResult> results(chunks.size());
+        for (qsizetype i = 0; i < chunks.size(); i++) {
+            results[i].model = chunks[i].model;
+            results[i].folder_id = chunks[i].folder_id;
+            results[i].chunk_id = chunks[i].chunk_id;
         }
 
-        constexpr int BATCH_SIZE = 4;
-        std::vector<float> result;
-        result.resize(chunks.size() * m_model->embeddingSize());
-        for (int j = 0; j < chunks.size(); j += BATCH_SIZE) {
-            QMutexLocker locker(&m_mutex);
-            std::vector batchTexts(texts.begin() + j, texts.begin() + std::min(j + BATCH_SIZE, int(texts.size())));
+        QMutexLocker locker(&m_mutex);
+        QList<LLModel *> models { m_model };
+        models += m_extraModels;
+        const qsizetype nModels = std::min(models.size(), chunks.size());
+        const size_t embeddingSize = m_model->embeddingSize();
+        EmbeddingResult *out = results.data();
+        std::vector<std::string> errors(nModels);
+
+        auto run = [&](qsizetype m) {
+            std::vector<std::string> texts;
+            for (size_t j = m; j < order.size(); j += nModels)
+                texts.push_back(chunks[order[j]].chunk.toStdString());
+
+            std::vector<float> result(texts.size() * embeddingSize);
             try {
-                m_model->embed(batchTexts, result.data() + j * m_model->embeddingSize(), /*isRetrieval*/ false);
+                models[m]->embed(texts, result.data(), /*isRetrieval*/ false);
             } catch (const std::exception &e) {
-                qWarning() << "WARNING: LLModel::embed failed:" << e.what();
+                errors[m] = e.what();
                 return;
             }
+
+            auto row = result.begin();
+            for (size_t j = m; j < order.size(); j += nModels, row += embeddingSize)
+                out[order[j]].embedding.assign(row, row + embeddingSize);
+        };
+
+        QSemaphore done;
+        for (qsizetype m = 1; m < nModels; m++)
+            m_extraModelThreads.start([&run, &done, m] { run(m); done.release(); });
+        run(0);
+        done.acquire(nModels - 1);
+        locker.unlock();
+
+        if (auto error = std::ranges::find_if(errors, [](auto &e) { return !e.empty(); }); error != errors.end()) {
+            qWarning() << "WARNING: LLModel::embed failed:" << error->c_str();
+            emit errorGenerated(chunks, u"ERROR: Embedding failed: %1"_s.arg(QString::fromStdString(*error)));
+            return;
         }
-        for (int i = 0; i < chunks.size(); i++)
-            memcpy(results[i].embedding.data(), &result[i * m_model->embeddingSize()], m_model->embeddingSize() * sizeof(float));
 
         emit embeddingsGenerated(results);
         return;
@@ -383,6 +463,8 @@ void EmbeddingLLMWorker::handleFinished()
     QJsonDocument document = QJsonDocument::fromJson(jsonData, &err);
     if (err.error != QJsonParseError::NoError) {
         qWarning() << "ERROR: Couldn't parse Nomic Atlas response:" << jsonData << err.errorString();
+        if (!chunks.isEmpty())
+            emit errorGenerated(chunks, u"ERROR: Couldn't parse Nomic Atlas response"_s);
         return;
     }
 
@@ -390,7 +472,11 @@ void EmbeddingLLMWorker::handleFinished()
     const QJsonArray embeddings = root.value("embeddings").toArray();
 
     if (!chunks.isEmpty()) {
-        emit embeddingsGenerated(jsonArrayToEmbeddingResults(chunks, embeddings));
+        auto results = jsonArrayToEmbeddingResults(chunks, embeddings);
+        if (results.isEmpty())
+            emit errorGenerated(chunks, u"ERROR: Nomic Atlas returned the wrong number of embeddings"_s);
+        else
+            emit embeddingsGenerated(results);
     } else {
         m_lastResponse = jsonArrayToVector(embeddings);
         emit finished();
@@ -409,14 +495,90 @@ EmbeddingLLM::EmbeddingLLM()
         &EmbeddingLLM::embeddingsGenerated, Qt::QueuedConnection);
     connect(m_embeddingWorker, &EmbeddingLLMWorker::errorGenerated, this,
         &EmbeddingLLM::errorGenerated, Qt::QueuedConnection);
+
+    m_queryCache.setMaxCost(QUERY_CACHE_SIZE);
+    if (MySettings::globalInstance()->localDocsSaveQueryEmbeddings())
+        loadQueryCache();
 }
 
 EmbeddingLLM::~EmbeddingLLM()
 {
+    if (MySettings::globalInstance()->localDocsSaveQueryEmbeddings())
+        saveQueryCache();
     delete m_embeddingWorker;
     m_embeddingWorker = nullptr;
 }
 
+static QString queryCachePath()
+{
+    return MySettings::globalInstance()->modelPath() + "/localdocs-query-embeddings.cache";
+}
+
+QByteArray EmbeddingLLM::queryCacheKey(const QString &text) const
+{
+    QString modelId = m_embeddingWorker->queryModelId();
+    if (modelId.isEmpty())
+        return {};
+    // the text is hashed so that a saved cache does not contain the questions themselves
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    hash.addData(modelId.toUtf8());
+    hash.addData("\nsearch_query\n");
+    hash.addData(text.simplified().toUtf8());
+    return hash.result();
+}
+
+void EmbeddingLLM::loadQueryCache()
+{
+    QFile file(queryCachePath());
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+
+    QDataStream in(&file);
+    quint32 magic;
+    qint32 version, count;
+    in >> magic >> version;
+    if (magic != QUERY_CACHE_MAGIC || version != QUERY_CACHE_VERSION) {
+        qWarning() << "WARNING: ignoring query embedding cache with unknown format" << file.fileName();
+        return;
+    }
+    in.setVersion(QDataStream::Qt_6_2);
+    in >> count;
+    for (qint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+        QByteArray key;
+        QList<float> values;
+        in >> key >> values;
+        if (in.status() == QDataStream::Ok)
+            m_queryCache.insert(key, new std::vector<float>(values.begin(), values.end()));
+    }
+    if (in.status() != QDataStream::Ok)
+        qWarning() << "WARNING: query embedding cache is truncated" << file.fileName();
+}
+
+void EmbeddingLLM::saveQueryCache()
+{
+    QMutexLocker locker(&m_queryCacheMutex);
+    if (!m_queryCacheChanged)
+        return;
+
+    QSaveFile file(queryCachePath());
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "WARNING: could not save query embedding cache" << file.fileName() << file.errorString();
+        return;
+    }
+
+    QDataStream out(&file);
+    out << QUERY_CACHE_MAGIC << QUERY_CACHE_VERSION;
+    out.setVersion(QDataStream::Qt_6_2);
+    const auto keys = m_queryCache.keys();
+    out << qint32(keys.size());
+    for (const auto &key: keys) {
+        const auto *embedding = m_queryCache.object(key);
+        out << key << QList<float>(embedding->begin(), embedding->end());
+    }
+    if (out.status() != QDataStream::Ok || !file.commit())
+        qWarning() << "WARNING: could not save query embedding cache" << file.fileName() << file.errorString();
+}
+
 QString EmbeddingLLM::model()
 {
     return EMBEDDING_MODEL_NAME;
@@ -425,7 +587,22 @@ QString EmbeddingLLM::model()
 // TODO(jared): embed using all necessary embedding models given collection
 std::vector<float> EmbeddingLLM::generateQueryEmbedding(const QString &text)
 {
-    return m_embeddingWorker->generateQueryEmbedding(text);
+    const QByteArray key = queryCacheKey(text);
+    if (!key.isEmpty()) {
+        QMutexLocker locker(&m_queryCacheMutex);
+        if (auto *embedding = m_queryCache.object(key))
+            return *embedding;
+    }
+
+    std::vector<float> embedding = m_embeddingWorker->generateQueryEmbedding(text);
+    // the first query loads the model, so only then is there a key
+    const QByteArray newKey = key.isEmpty() ? queryCacheKey(text) : key;
+    if (!newKey.isEmpty() && !embedding.empty()) {
+        QMutexLocker locker(&m_queryCacheMutex);
+        m_queryCache.insert(newKey, new std::vector<float>(embedding));
+        m_queryCacheChanged = true;
+    }
+    return embedding;
 }
 
 void EmbeddingLLM::generateDocEmbeddingsAsync(const QVector<EmbeddingChunk> &chunks)
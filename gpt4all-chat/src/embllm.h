@@ -2,11 +2,14 @@
 #define EMBLLM_H
 
 #include <QByteArray>
+#include <QCache>
+#include <QList>
 #include <QMutex>
 #include <QObject>
 #include <QString>
 #include <QStringList>
 #include <QThread>
+#include <QThreadPool>
 #include <QVariant>
 #include <QVector>
 
@@ -46,6 +49,8 @@ public:
     bool isNomic() const { return !m_nomicAPIKey.isEmpty(); }
     bool hasModel() const { return isNomic() || m_model; }
 
+    // identifies the model that query embeddings come from; empty until it has been loaded
+    QString queryModelId() const;
     std::vector<float> generateQueryEmbedding(const QString &text);
 
 public Q_SLOTS:
@@ -63,14 +68,19 @@ private Q_SLOTS:
 
 private:
     void sendAtlasRequest(const QStringList &texts, const QString &taskType, const QVariant &userData = {});
+    void setQueryModelId(const QString &modelId);
 
     QString m_nomicAPIKey;
     QNetworkAccessManager *m_networkManager;
     std::vector<float> m_lastResponse;
     LLModel *m_model = nullptr;
+    QList<LLModel *> m_extraModels; // more contexts for documents, on the CPU only
+    QThreadPool m_extraModelThreads;
     std::atomic<bool> m_stopGenerating;
     QThread m_workerThread;
-    QMutex m_mutex; // guards m_model and m_nomicAPIKey
+    QMutex m_mutex; // guards m_model, m_extraModels and m_nomicAPIKey
+    QString m_modelId;
+    mutable QMutex m_modelIdMutex; // guards only m_modelId, so it can be read while m_mutex is held for embedding
 };
 
 class EmbeddingLLM : public QObject
@@ -94,7 +104,18 @@ Q_SIGNALS:
     void errorGenerated(const QVector<EmbeddingChunk> &chunks, const QString &error);
 
 private:
+    // empty until the embedding model has been loaded
+    QByteArray queryCacheKey(const QString &text) const;
+    void loadQueryCache();
+    void saveQueryCache();
+
     EmbeddingLLMWorker *m_embeddingWorker;
+
+    // Recent query embeddings, so that asking the same question again (e.g. when regenerating a response) does not
+    // run the embedding model. Keyed by a hash of the model, the task prefix and the normalized text.
+    QCache<QByteArray, std::vector<float>> m_queryCache;
+    QMutex m_queryCacheMutex; // guards m_queryCache and m_queryCacheChanged
+    bool m_queryCacheChanged = false;
 };
 
 #endif // EMBLLM_H
@@ -0,0 +1,139 @@
+#include "metrics.h"
+
+#include <QGlobalStatic>
+#include <QMutexLocker>
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+using namespace Qt::Literals::StringLiterals;
+
+
+class MyMetrics: public Metrics { };
+Q_GLOBAL_STATIC(MyMetrics, metricsInstance)
+Metrics *Metrics::globalInstance()
+{
+    return metricsInstance();
+}
+
+Metrics::Metrics()
+    : m_timeToFirstToken({ .05, .1, .25, .5, 1, 2.5, 5, 10, 30, 60 })
+    , m_prefillSpeed    ({ 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000 })
+    , m_decodeSpeed     ({ 1, 2.5, 5, 10, 20, 40, 80, 160, 320 })
+    , m_modelLoad       ({ .5, 1, 2.5, 5, 10, 20, 40, 80, 160 })
+    , m_retrieval       ({ .005, .01, .025, .05, .1, .25, .5, 1, 2.5, 5 })
+{}
+
+Metrics::Histogram::Histogram(std::vector<double> bounds)
+    : bounds(std::move(bounds))
+    , counts(this->bounds.size() + 1)
+{}
+
+void Metrics::Histogram::observe(double value)
+{
+    auto bucket = std::ranges::lower_bound(bounds, value);
+    counts[std::distance(bounds.begin(), bucket)]++;
+    sum += value;
+    count++;
+}
+
+void Metrics::Histogram::write(QByteArray &out, const char *name, const char *help) const
+{
+    out += "# HELP "_ba + name + ' ' + help + '\n';
+    out += "# TYPE "_ba + name + " histogram\n";
+    quint64 cumulative = 0;
+    for (size_t i = 0; i < bounds.size(); i++) {
+        cumulative += counts[i];
+        out += name + "_bucket{le=\""_ba + QByteArray::number(bounds[i]) + "\"} " + QByteArray::number(cumulative)
+            + '\n';
+    }
+    out += name + "_bucket{le=\"+Inf\"} "_ba + QByteArray::number(count) + '\n';
+    out += name + "_sum "_ba + QByteArray::number(sum) + '\n';
+    out += name + "_count "_ba + QByteArray::number(count) + '\n';
+}
+
+void Metrics::recordRequest()
+{
+    QMutexLocker locker(&m_mutex);
+    m_requestsTotal++;
+}
+
+void Metrics::recordPrompt(quint64 cachedTokens, quint64 evaluatedTokens, quint64 contextShifts)
+{
+    QMutexLocker locker(&m_mutex);
+    m_cachedTokens    += cachedTokens;
+    m_evaluatedTokens += evaluatedTokens;
+    m_contextShifts   += contextShifts;
+}
+
+void Metrics::recordResponse(double timeToFirstToken, quint64 evaluatedTokens, quint64 responseTokens,
+                             double totalTime)
+{
+    QMutexLocker locker(&m_mutex);
+    m_responseTokens += responseTokens;
+    if (!responseTokens)
+        return; // stopped or failed before the first token; there is nothing to time
+
+    m_timeToFirstToken.observe(timeToFirstToken);
+    if (evaluatedTokens && timeToFirstToken > 0)
+        m_prefillSpeed.observe(evaluatedTokens / timeToFirstToken);
+    // the first token is produced by the prefill, so it does not count towards decoding
+    if (double decodeTime = totalTime - timeToFirstToken; responseTokens > 1 && decodeTime > 0)
+        m_decodeSpeed.observe((responseTokens - 1) / decodeTime);
+}
+
+void Metrics::recordModelLoad(double seconds)
+{
+    QMutexLocker locker(&m_mutex);
+    m_modelLoad.observe(seconds);
+}
+
+void Metrics::recordRetrieval(double seconds)
+{
+    QMutexLocker locker(&m_mutex);
+    m_retrieval.observe(seconds);
+}
+
+void Metrics::recordResponseCacheLookup(bool hit)
+{
+    QMutexLocker locker(&m_mutex);
+    (hit ? m_cacheHits : m_cacheMisses)++;
+}
+
+static void writeScalar(QByteArray &out, const char *name, const char *help, const char *type, quint64 value)
+{
+    out += "# HELP "_ba + name + ' ' + help + '\n';
+    out += "# TYPE "_ba + name + ' ' + type + '\n';
+    out += name + " "_ba + QByteArray::number(value) + '\n';
+}
+
+QByteArray Metrics::toPrometheus() const
+{
+    QMutexLocker locker(&m_mutex);
+    QByteArray out;
+    writeScalar(out, "gpt4all_server_requests_total", "API requests accepted.", "counter", m_requestsTotal);
+
+    // the prompt cache hit ratio is cached / (cached + evaluated)
+    out += "# HELP gpt4all_prompt_tokens_total Prompt tokens, by whether they were reused from the KV cache.\n"
+           "# TYPE gpt4all_prompt_tokens_total counter\n";
+    out += "gpt4all_prompt_tokens_total{cached=\"true\"} "_ba  + QByteArray::number(m_cachedTokens)    + '\n';
+    out += "gpt4all_prompt_tokens_total{cached=\"false\"} "_ba + QByteArray::number(m_evaluatedTokens) + '\n';
+
+    out += "# HELP gpt4all_response_cache_lookups_total API response cache lookups, by result.\n"
+           "# TYPE gpt4all_response_cache_lookups_total counter\n";
+    out += "gpt4all_response_cache_lookups_total{result=\"hit\"} "_ba  + QByteArray::number(m_cacheHits)   + '\n';
+    out += "gpt4all_response_cache_lookups_total{result=\"miss\"} "_ba + QByteArray::number(m_cacheMisses) + '\n';
+
+    writeScalar(out, "gpt4all_response_tokens_total", "Generated tokens.", "counter", m_responseTokens);
+    writeScalar(out, "gpt4all_context_shifts_total",
+                "Times the context window was full and older tokens were discarded.", "counter", m_contextShifts);
+
+    m_timeToFirstToken.write(out, "gpt4all_time_to_first_token_seconds",
+                             "Time from the start of prompt processing to the first generated token.");
+    m_prefillSpeed.write(out, "gpt4all_prefill_tokens_per_second", "Prompt processing speed, excluding cached tokens.");
+    m_decodeSpeed.write(out, "gpt4all_decode_tokens_per_second", "Generation speed after the first token.");
+    m_modelLoad.write(out, "gpt4all_model_load_seconds", "Time to load a local model.");
+    m_retrieval.write(out, "gpt4all_localdocs_retrieval_seconds", "Time to retrieve LocalDocs sources for a prompt.");
+    return out;
+}
@@ -0,0 +1,64 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QByteArray>
+#include <QMutex>
+#include <QtGlobal>
+
+#include <vector>
+
+// Process-wide performance counters, exported by the API server at /metrics in the Prometheus text format.
+// All methods are thread-safe. The API server answers one request at a time, so a scrape that arrives during a
+// generation is answered once the generation is done.
+class Metrics
+{
+public:
+    static Metrics *globalInstance();
+
+    // One call per completion request handled by the API server
+    void recordRequest();
+
+    // One call per generation. Times are in seconds, measured from the start of prompt processing.
+    void recordPrompt(quint64 cachedTokens, quint64 evaluatedTokens, quint64 contextShifts);
+    void recordResponse(double timeToFirstToken, quint64 evaluatedTokens, quint64 responseTokens,
+                        double totalTime);
+
+    void recordModelLoad(double seconds);
+    void recordRetrieval(double seconds);
+    void recordResponseCacheLookup(bool hit);
+
+    QByteArray toPrometheus() const;
+
+protected:
+    explicit Metrics();
+
+private:
+    struct Histogram {
+        explicit Histogram(std::vector<double> bounds);
+        void observe(double value);
+        void write(QByteArray &out, const char *name, const char *help) const;
+
+        std::vector<double>  bounds;
+        std::vector<quint64> counts; // non-cumulative; one extra for +Inf
+        double               sum   = 0;
+        quint64              count = 0;
+    };
+
+    mutable QMutex m_mutex;
+    quint64   m_requestsTotal   = 0;
+    quint64   m_cachedTokens    = 0;
+    quint64   m_evaluatedTokens = 0;
+    quint64   m_responseTokens  = 0;
+    quint64   m_contextShifts   = 0;
+    quint64   m_cacheHits       = 0;
+    quint64   m_cacheMisses     = 0;
+    Histogram m_timeToFirstToken;
+    Histogram m_prefillSpeed;
+    Histogram m_decodeSpeed;
+    Histogram m_modelLoad;
+    Histogram m_retrieval;
+
+    friend class MyMetrics;
+};
+
+#endif // METRICS_H
@@ -5,12 +5,12 @@
 
 #include <gpt4all-backend/llmodel.h>
 
+#include <QCoreApplication>
 #include <QDebug>
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
 #include <QGlobalStatic>
-#include <QGuiApplication>
 #include <QIODevice>
 #include <QMap>
 #include <QMetaObject>
@@ -52,22 +52,32 @@ static const QString languageAndLocale       = "System Locale";
 } // namespace defaults
 
 static const QVariantMap basicDefaults {
-    { "chatTheme",                QVariant::fromValue(ChatTheme::Light) },
-    { "fontSize",                 QVariant::fromValue(FontSize::Small) },
-    { "lastVersionStarted",       "" },
-    { "networkPort",              4891, },
-    { "systemTray",               false },
-    { "serverChat",               false },
-    { "userDefaultModel",         "Application default" },
-    { "suggestionMode",           QVariant::fromValue(SuggestionMode::LocalDocsOnly) },
-    { "localdocs/chunkSize",      512 },
-    { "localdocs/retrievalSize",  3 },
-    { "localdocs/showReferences", true },
-    { "localdocs/fileExtensions", QStringList { "docx", "pdf", "txt", "md", "rst" } },
-    { "localdocs/useRemoteEmbed", false },
-    { "localdocs/nomicAPIKey",    "" },
-    { "localdocs/embedDevice",    "Auto" },
-    { "network/attribution",      "" },
+    { "chatTheme",                     QVariant::fromValue(ChatTheme::Light) },
+    { "fontSize",                      QVariant::fromValue(FontSize::Small) },
+    { "lastVersionStarted",            "" },
+    { "networkPort",                   4891, },
+    { "systemTray",                    false },
+    { "chat/saveContext",              false },
+    { "chat/saveContextSize",          1024 },
+    { "serverChat",                    false },
+    { "server/mirrorChat",             true },
+    { "server/responseCache",          false },
+    { "server/responseCacheSize",      256 },
+    { "userDefaultModel",              "Application default" },
+    { "suggestionMode",                QVariant::fromValue(SuggestionMode::LocalDocsOnly) },
+    { "responseUpdateInterval",        16 },
+    { "workerThreads",                 0 },
+    { "localdocs/chunkSize",           512 },
+    { "localdocs/retrievalSize",       3 },
+    { "localdocs/showReferences",      true },
+    { "localdocs/fileExtensions",      QStringList { "docx", "pdf", "txt", "md", "rst" } },
+    { "localdocs/useRemoteEmbed",      false },
+    { "localdocs/nomicAPIKey",         "" },
+    { "localdocs/embedDevice",         "Auto" },
+    { "localdocs/indexQuantization",   "i8" },
+    { "localdocs/saveQueryEmbeddings", false },
+    { "localdocs/embeddingContexts",   1 },
+    { "network/attribution",           "" },
 };
 
 static QString defaultLocalModelsPath()
@@ -204,9 +214,17 @@ void MySettings::onModelInfoChanged(const QModelIndex &topLeft, const QModelInde
 
 QVariant MySettings::getBasicSetting(const QString &name) const
 {
+    if (auto it = m_overrides.constFind(name); it != m_overrides.cend())
+        return *it;
     return m_settings.value(name, basicDefaults.value(name));
 }
 
+void MySettings::overrideBasicSetting(const QString &name, const QVariant &value)
+{
+    Q_ASSERT(basicDefaults.contains(name));
+    m_overrides.insert(name, value);
+}
+
 void MySettings::setBasicSetting(const QString &name, const QVariant &value, std::optional<QString> signal)
 {
     if (getBasicSetting(name) == value)
@@ -246,9 +264,14 @@ void MySettings::restoreApplicationDefaults()
     setFontSize(basicDefaults.value("fontSize").value<FontSize>());
     setDevice(defaults::device);
     setThreadCount(defaults::threadCount);
+    setChatSaveContext(basicDefaults.value("chat/saveContext").toBool());
+    setChatSaveContextSize(basicDefaults.value("chat/saveContextSize").toInt());
     setSystemTray(basicDefaults.value("systemTray").toBool());
     setServerChat(basicDefaults.value("serverChat").toBool());
     setNetworkPort(basicDefaults.value("networkPort").toInt());
+    setServerMirrorChat(basicDefaults.value("server/mirrorChat").toBool());
+    setServerResponseCache(basicDefaults.value("server/responseCache").toBool());
+    setServerResponseCacheSize(basicDefaults.value("server/responseCacheSize").toInt());
     setModelPath(defaultLocalModelsPath());
     setUserDefaultModel(basicDefaults.value("userDefaultModel").toString());
     setForceMetal(defaults::forceMetal);
@@ -612,27 +635,42 @@ void MySettings::setThreadCount(int value)
     emit threadCountChanged();
 }
 
-bool        MySettings::systemTray() const              { return getBasicSetting("systemTray"              ).toBool(); }
-bool        MySettings::serverChat() const              { return getBasicSetting("serverChat"              ).toBool(); }
-int         MySettings::networkPort() const             { return getBasicSetting("networkPort"             ).toInt(); }
-QString     MySettings::userDefaultModel() const        { return getBasicSetting("userDefaultModel"        ).toString(); }
-QString     MySettings::lastVersionStarted() const      { return getBasicSetting("lastVersionStarted"      ).toString(); }
-int         MySettings::localDocsChunkSize() const      { return getBasicSetting("localdocs/chunkSize"     ).toInt(); }
-int         MySettings::localDocsRetrievalSize() const  { return getBasicSetting("localdocs/retrievalSize" ).toInt(); }
-bool        MySettings::localDocsShowReferences() const { return getBasicSetting("localdocs/showReferences").toBool(); }
-QStringList MySettings::localDocsFileExtensions() const { return getBasicSetting("localdocs/fileExtensions").toStringList(); }
-bool        MySettings::localDocsUseRemoteEmbed() const { return getBasicSetting("localdocs/useRemoteEmbed").toBool(); }
-QString     MySettings::localDocsNomicAPIKey() const    { return getBasicSetting("localdocs/nomicAPIKey"   ).toString(); }
-QString     MySettings::localDocsEmbedDevice() const    { return getBasicSetting("localdocs/embedDevice"   ).toString(); }
-QString     MySettings::networkAttribution() const      { return getBasicSetting("network/attribution"     ).toString(); }
+bool        MySettings::systemTray() const                   { return getBasicSetting("systemTray"                   ).toBool(); }
+bool        MySettings::chatSaveContext() const              { return getBasicSetting("chat/saveContext"             ).toBool(); }
+int         MySettings::chatSaveContextSize() const          { return getBasicSetting("chat/saveContextSize"         ).toInt(); }
+bool        MySettings::serverChat() const                   { return getBasicSetting("serverChat"                   ).toBool(); }
+int         MySettings::networkPort() const                  { return getBasicSetting("networkPort"                  ).toInt(); }
+bool        MySettings::serverMirrorChat() const             { return getBasicSetting("server/mirrorChat"            ).toBool(); }
+bool        MySettings::serverResponseCache() const          { return getBasicSetting("server/responseCache"         ).toBool(); }
+int         MySettings::serverResponseCacheSize() const      { return getBasicSetting("server/responseCacheSize"     ).toInt(); }
+int         MySettings::responseUpdateInterval() const       { return getBasicSetting("responseUpdateInterval"       ).toInt(); }
+int         MySettings::workerThreads() const                { return getBasicSetting("workerThreads"                ).toInt(); }
+QString     MySettings::userDefaultModel() const             { return getBasicSetting("userDefaultModel"             ).toString(); }
+QString     MySettings::lastVersionStarted() const           { return getBasicSetting("lastVersionStarted"           ).toString(); }
+int         MySettings::localDocsChunkSize() const           { return getBasicSetting("localdocs/chunkSize"          ).toInt(); }
+int         MySettings::localDocsRetrievalSize() const       { return getBasicSetting("localdocs/retrievalSize"      ).toInt(); }
+bool        MySettings::localDocsShowReferences() const      { return getBasicSetting("localdocs/showReferences"     ).toBool(); }
+QStringList MySettings::localDocsFileExtensions() const      { return getBasicSetting("localdocs/fileExtensions"     ).toStringList(); }
+bool        MySettings::localDocsUseRemoteEmbed() const      { return getBasicSetting("localdocs/useRemoteEmbed"     ).toBool(); }
+QString     MySettings::localDocsNomicAPIKey() const         { return getBasicSetting("localdocs/nomicAPIKey"        ).toString(); }
+QString     MySettings::localDocsEmbedDevice() const         { return getBasicSetting("localdocs/embedDevice"        ).toString(); }
+QString     MySettings::localDocsIndexQuantization() const   { return getBasicSetting("localdocs/indexQuantization"  ).toString(); }
+bool        MySettings::localDocsSaveQueryEmbeddings() const { return getBasicSetting("localdocs/saveQueryEmbeddings").toBool(); }
+int         MySettings::localDocsEmbeddingContexts() const   { return getBasicSetting("localdocs/embeddingContexts"  ).toInt(); }
+QString     MySettings::networkAttribution() const           { return getBasicSetting("network/attribution"          ).toString(); }
 
 ChatTheme      MySettings::chatTheme() const      { return ChatTheme     (getEnumSetting("chatTheme", chatThemeNames)); }
 FontSize       MySettings::fontSize() const       { return FontSize      (getEnumSetting("fontSize",  fontSizeNames)); }
 SuggestionMode MySettings::suggestionMode() const { return SuggestionMode(getEnumSetting("suggestionMode", suggestionModeNames)); }
 
 void MySettings::setSystemTray(bool value)                            { setBasicSetting("systemTray",               value); }
+void MySettings::setChatSaveContext(bool value)                       { setBasicSetting("chat/saveContext",         value, "chatSaveContext"); }
+void MySettings::setChatSaveContextSize(int value)                    { setBasicSetting("chat/saveContextSize",     value, "chatSaveContextSize"); }
 void MySettings::setServerChat(bool value)                            { setBasicSetting("serverChat",               value); }
 void MySettings::setNetworkPort(int value)                            { setBasicSetting("networkPort",              value); }
+void MySettings::setServerMirrorChat(bool value)                      { setBasicSetting("server/mirrorChat",        value, "serverMirrorChat"); }
+void MySettings::setServerResponseCache(bool value)                   { setBasicSetting("server/responseCache",     value, "serverResponseCache"); }
+void MySettings::setServerResponseCacheSize(int value)                { setBasicSetting("server/responseCacheSize", value, "serverResponseCacheSize"); }
 void MySettings::setUserDefaultModel(const QString &value)            { setBasicSetting("userDefaultModel",         value); }
 void MySettings::setLastVersionStarted(const QString &value)          { setBasicSetting("lastVersionStarted",       value); }
 void MySettings::setLocalDocsChunkSize(int value)                     { setBasicSetting("localdocs/chunkSize",      value, "localDocsChunkSize"); }
@@ -804,7 +842,7 @@ void MySettings::setLanguageAndLocale(const QString &bcp47Name)
 
     // If we previously installed a translator, then remove it
     if (m_translator) {
-        if (!qGuiApp->removeTranslator(m_translator.get())) {
+        if (!QCoreApplication::removeTranslator(m_translator.get())) {
             qDebug() << "ERROR: Failed to remove the previous translator";
         } else {
             m_translator.reset();
@@ -826,7 +864,7 @@ void MySettings::setLanguageAndLocale(const QString &bcp47Name)
         }
 
         // If we've successfully loaded it, then try and install it
-        if (!qGuiApp->installTranslator(m_translator.get())) {
+        if (!QCoreApplication::installTranslator(m_translator.get())) {
             qDebug() << "ERROR: Failed to install the translator:" << filePath;
             m_translator.reset();
         }
@@ -4,6 +4,7 @@
 #include "modellist.h" // IWYU pragma: keep
 
 #include <QDateTime>
+#include <QHash>
 #include <QLatin1StringView>
 #include <QList>
 #include <QModelIndex>
@@ -12,6 +13,7 @@
 #include <QString>
 #include <QStringList>
 #include <QTranslator>
+#include <QVariant>
 #include <QVector>
 
 #include <cstdint>
@@ -52,6 +54,8 @@ class MySettings : public QObject
     Q_OBJECT
     Q_PROPERTY(int threadCount READ threadCount WRITE setThreadCount NOTIFY threadCountChanged)
     Q_PROPERTY(bool systemTray READ systemTray WRITE setSystemTray NOTIFY systemTrayChanged)
+    Q_PROPERTY(bool chatSaveContext READ chatSaveContext WRITE setChatSaveContext NOTIFY chatSaveContextChanged)
+    Q_PROPERTY(int chatSaveContextSize READ chatSaveContextSize WRITE setChatSaveContextSize NOTIFY chatSaveContextSizeChanged)
     Q_PROPERTY(bool serverChat READ serverChat WRITE setServerChat NOTIFY serverChatChanged)
     Q_PROPERTY(QString modelPath READ modelPath WRITE setModelPath NOTIFY modelPathChanged)
     Q_PROPERTY(QString userDefaultModel READ userDefaultModel WRITE setUserDefaultModel NOTIFY userDefaultModelChanged)
@@ -74,6 +78,9 @@ class MySettings : public QObject
     Q_PROPERTY(QStringList deviceList MEMBER m_deviceList CONSTANT)
     Q_PROPERTY(QStringList embeddingsDeviceList MEMBER m_embeddingsDeviceList CONSTANT)
     Q_PROPERTY(int networkPort READ networkPort WRITE setNetworkPort NOTIFY networkPortChanged)
+    Q_PROPERTY(bool serverMirrorChat READ serverMirrorChat WRITE setServerMirrorChat NOTIFY serverMirrorChatChanged)
+    Q_PROPERTY(bool serverResponseCache READ serverResponseCache WRITE setServerResponseCache NOTIFY serverResponseCacheChanged)
+    Q_PROPERTY(int serverResponseCacheSize READ serverResponseCacheSize WRITE setServerResponseCacheSize NOTIFY serverResponseCacheSizeChanged)
     Q_PROPERTY(SuggestionMode suggestionMode READ suggestionMode WRITE setSuggestionMode NOTIFY suggestionModeChanged)
     Q_PROPERTY(QStringList uiLanguages MEMBER m_uiLanguages CONSTANT)
 
@@ -94,6 +101,9 @@ public:
     Q_INVOKABLE void restoreApplicationDefaults();
     Q_INVOKABLE void restoreLocalDocsDefaults();
 
+    // Process-lifetime override of a basic setting; takes precedence over the stored value and is never persisted
+    void overrideBasicSetting(const QString &name, const QVariant &value);
+
     // Model/Character settings
     void eraseModel(const ModelInfo &info);
     QString modelName(const ModelInfo &info) const;
@@ -158,6 +168,10 @@ public:
     void setThreadCount(int value);
     bool systemTray() const;
     void setSystemTray(bool value);
+    bool chatSaveContext() const;
+    void setChatSaveContext(bool value);
+    int chatSaveContextSize() const; // MiB
+    void setChatSaveContextSize(int value);
     bool serverChat() const;
     void setServerChat(bool value);
     QString modelPath();
@@ -178,6 +192,8 @@ public:
     void setGpuLayers(int32_t value);
     SuggestionMode suggestionMode() const;
     void setSuggestionMode(SuggestionMode value);
+    int responseUpdateInterval() const; // ms; only set by editing the settings file
+    int workerThreads() const; // 0 = one per CPU core; only set by editing the settings file
 
     QString languageAndLocale() const;
     void setLanguageAndLocale(const QString &bcp47Name = QString()); // called on startup with QString()
@@ -201,6 +217,9 @@ public:
     void setLocalDocsNomicAPIKey(const QString &value);
     QString localDocsEmbedDevice() const;
     void setLocalDocsEmbedDevice(const QString &value);
+    QString localDocsIndexQuantization() const; // "f32", "i8" or "b1"; only set by editing the settings file
+    bool localDocsSaveQueryEmbeddings() const; // only set by editing the settings file
+    int localDocsEmbeddingContexts() const; // 0 = one per threadCount CPU cores; only set by editing the settings file
 
     // Network settings
     QString networkAttribution() const;
@@ -213,6 +232,12 @@ public:
     void setNetworkUsageStatsActive(bool value);
     int networkPort() const;
     void setNetworkPort(int value);
+    bool serverMirrorChat() const;
+    void setServerMirrorChat(bool value);
+    bool serverResponseCache() const;
+    void setServerResponseCache(bool value);
+    int serverResponseCacheSize() const; // MiB
+    void setServerResponseCacheSize(int value);
 
 Q_SIGNALS:
     void nameChanged(const ModelInfo &info);
@@ -234,6 +259,8 @@ Q_SIGNALS:
     void suggestedFollowUpPromptChanged(const ModelInfo &info);
     void threadCountChanged();
     void systemTrayChanged();
+    void chatSaveContextChanged();
+    void chatSaveContextSizeChanged();
     void serverChatChanged();
     void modelPathChanged();
     void userDefaultModelChanged();
@@ -251,6 +278,9 @@ Q_SIGNALS:
     void networkAttributionChanged();
     void networkIsActiveChanged();
     void networkPortChanged();
+    void serverMirrorChatChanged();
+    void serverResponseCacheChanged();
+    void serverResponseCacheSizeChanged();
     void networkUsageStatsActiveChanged();
     void attemptModelLoadChanged();
     void deviceChanged();
@@ -283,6 +313,7 @@ private:
 
 private:
     QSettings m_settings;
+    QHash<QString, QVariant> m_overrides;
     bool m_forceMetal;
     const QStringList m_deviceList;
     const QStringList m_embeddingsDeviceList;
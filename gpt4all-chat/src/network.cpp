@@ -16,13 +16,11 @@
 #include <QDateTime>
 #include <QDebug>
 #include <QGlobalStatic>
-#include <QGuiApplication>
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QLibraryInfo>
 #include <QNetworkRequest>
-#include <QScreen>
 #include <QSettings>
 #include <QSize>
 #include <QSslConfiguration>
@@ -38,6 +36,11 @@
 #include <cstring>
 #include <utility>
 
+#ifndef GPT4ALL_HEADLESS
+#   include <QGuiApplication>
+#   include <QScreen>
+#endif
+
 #ifdef __GLIBC__
 #   include <gnu/libc-version.h>
 #endif
@@ -228,7 +231,7 @@ bool Network::packageAndSendJson(const QString &ingestId, const QString &json)
     QByteArray body(newDoc.toJson(QJsonDocument::Compact));
     request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
     QNetworkReply *jsonReply = m_networkManager.post(request, body);
-    connect(qGuiApp, &QCoreApplication::aboutToQuit, jsonReply, &QNetworkReply::abort);
+    connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, jsonReply, &QNetworkReply::abort);
     connect(jsonReply, &QNetworkReply::finished, this, &Network::handleJsonUploadFinished);
     m_activeUploads.append(jsonReply);
     return true;
@@ -319,7 +322,9 @@ void Network::sendStartup()
     // only chance to enable usage stats is at the start of a new session
     m_sendUsageStats = true;
 
+#ifndef GPT4ALL_HEADLESS
     const auto *display = QGuiApplication::primaryScreen();
+#endif
     trackEvent("startup", {
         // Build info
         { "build_compiler",     COMPILER_NAME                                                         },
@@ -344,8 +349,10 @@ void Network::sendStartup()
 #ifdef Q_OS_MAC
         { "sys_hw_model",       getSysctl("hw.model").value_or(u"(unknown)"_s)                        },
 #endif
+#ifndef GPT4ALL_HEADLESS
         { "$screen_dpi",        std::round(display->physicalDotsPerInch())                            },
         { "display",            u"%1x%2"_s.arg(display->size().width()).arg(display->size().height()) },
+#endif
         { "ram",                LLM::globalInstance()->systemTotalRAMInGB()                           },
         { "cpu",                getCPUModel()                                                         },
         { "cpu_supports_avx2",  LLModel::Implementation::cpuSupportsAVX2()                            },
@@ -427,7 +434,7 @@ void Network::sendIpify()
     conf.setPeerVerifyMode(QSslSocket::VerifyNone);
     request.setSslConfiguration(conf);
     QNetworkReply *reply = m_networkManager.get(request);
-    connect(qGuiApp, &QCoreApplication::aboutToQuit, reply, &QNetworkReply::abort);
+    connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, reply, &QNetworkReply::abort);
     connect(reply, &QNetworkReply::finished, this, &Network::handleIpifyFinished);
 }
 
@@ -440,7 +447,7 @@ void Network::sendMixpanel(const QByteArray &json)
     request.setSslConfiguration(conf);
     request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
     QNetworkReply *trackReply = m_networkManager.post(request, json);
-    connect(qGuiApp, &QCoreApplication::aboutToQuit, trackReply, &QNetworkReply::abort);
+    connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, trackReply, &QNetworkReply::abort);
     connect(trackReply, &QNetworkReply::finished, this, &Network::handleMixpanelFinished);
 }
 
@@ -502,7 +509,7 @@ void Network::sendHealth()
     conf.setPeerVerifyMode(QSslSocket::VerifyNone);
     request.setSslConfiguration(conf);
     QNetworkReply *healthReply = m_networkManager.get(request);
-    connect(qGuiApp, &QCoreApplication::aboutToQuit, healthReply, &QNetworkReply::abort);
+    connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, healthReply, &QNetworkReply::abort);
     connect(healthReply, &QNetworkReply::finished, this, &Network::handleHealthFinished);
 }
 
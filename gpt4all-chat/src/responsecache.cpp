@@ -0,0 +1,100 @@
+#include "responsecache.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileDevice>
+#include <QFileInfo>
+#include <QIODevice>
+#include <QJsonDocument>
+#include <QJsonParseError>
+#include <QSaveFile>
+#include <QtLogging>
+
+using namespace Qt::Literals::StringLiterals;
+
+
+static const auto entryFilter = u"*.json"_s;
+
+ResponseCache::ResponseCache(const QString &dirPath)
+    : m_dirPath(dirPath)
+{
+    QDir dir(m_dirPath);
+    if (!dir.exists() && !dir.mkpath(u"."_s))
+        qWarning() << "WARNING: could not create response cache directory" << m_dirPath;
+
+    const auto entries = dir.entryInfoList({ entryFilter }, QDir::Files);
+    for (const auto &entry : entries)
+        m_totalBytes += entry.size();
+}
+
+QString ResponseCache::filePath(const QByteArray &key) const
+{
+    return u"%1/%2.json"_s.arg(m_dirPath, QString::fromLatin1(key.toHex()));
+}
+
+std::optional<QJsonObject> ResponseCache::find(const QByteArray &key)
+{
+    QFile file(filePath(key));
+    if (!file.open(QIODevice::ReadOnly))
+        return std::nullopt;
+
+    QJsonParseError err;
+    auto document = QJsonDocument::fromJson(file.readAll(), &err);
+    if (err.error != QJsonParseError::NoError || !document.isObject()) {
+        qWarning() << "WARNING: removing corrupt response cache entry" << file.fileName() << err.errorString();
+        m_totalBytes -= file.size();
+        file.close();
+        file.remove();
+        return std::nullopt;
+    }
+
+    // the modification time doubles as the last access time for eviction
+    file.setFileTime(QDateTime::currentDateTimeUtc(), QFileDevice::FileModificationTime);
+    return document.object();
+}
+
+void ResponseCache::insert(const QByteArray &key, const QJsonObject &response)
+{
+    const QString path = filePath(key);
+    const qint64 oldSize = QFileInfo(path).size(); // 0 if it does not exist
+
+    QByteArray data = QJsonDocument(response).toJson(QJsonDocument::Compact);
+    if (data.size() > m_maxBytes)
+        return;
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit()) {
+        qWarning() << "WARNING: could not write response cache entry" << path << file.errorString();
+        return;
+    }
+
+    m_totalBytes += data.size() - oldSize;
+    evict();
+}
+
+void ResponseCache::setMaxBytes(qint64 maxBytes)
+{
+    m_maxBytes = maxBytes;
+    evict();
+}
+
+void ResponseCache::evict()
+{
+    if (m_totalBytes <= m_maxBytes)
+        return;
+
+    // oldest first
+    const auto entries = QDir(m_dirPath).entryInfoList({ entryFilter }, QDir::Files, QDir::Time | QDir::Reversed);
+    m_totalBytes = 0;
+    for (const auto &entry : entries)
+        m_totalBytes += entry.size();
+
+    for (const auto &entry : entries) {
+        if (m_totalBytes <= m_maxBytes)
+            break;
+        if (QFile::remove(entry.filePath()))
+            m_totalBytes -= entry.size();
+    }
+}
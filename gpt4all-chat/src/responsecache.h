@@ -0,0 +1,32 @@
+#ifndef RESPONSECACHE_H
+#define RESPONSECACHE_H
+
+#include <QByteArray>
+#include <QJsonObject>
+#include <QString>
+#include <QtGlobal>
+
+#include <optional>
+
+// On-disk cache of API responses, used by the server for requests whose output is fully determined by the request
+// (greedy sampling). Each entry is a JSON file named after its key; the least recently used entries are removed once
+// the total size exceeds the budget. Not thread-safe: it is only used from the server thread.
+class ResponseCache
+{
+public:
+    explicit ResponseCache(const QString &dirPath);
+
+    std::optional<QJsonObject> find(const QByteArray &key);
+    void insert(const QByteArray &key, const QJsonObject &response);
+    void setMaxBytes(qint64 maxBytes);
+
+private:
+    QString filePath(const QByteArray &key) const;
+    void evict();
+
+    QString m_dirPath;
+    qint64  m_maxBytes   = 0;
+    qint64  m_totalBytes = 0;
+};
+
+#endif // RESPONSECACHE_H
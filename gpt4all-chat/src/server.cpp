@@ -2,8 +2,11 @@
 
 #include "chat.h"
 #include "chatmodel.h"
+#include "metrics.h"
 #include "modellist.h"
 #include "mysettings.h"
+#include "responsecache.h"
+#include "toolmodel.h"
 #include "utils.h"
 
 #include <fmt/format.h>
@@ -12,9 +15,15 @@
 #include <QCborArray>
 #include <QCborMap>
 #include <QCborValue>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDate>
 #include <QDateTime>
+#include <QDeadlineTimer>
 #include <QDebug>
+#include <QFileInfo>
 #include <QHostAddress>
+#include <QHttpServerRequest>
 #include <QHttpServer>
 #include <QHttpServerResponder>
 #include <QJsonArray>
@@ -22,13 +31,18 @@
 #include <QJsonObject>
 #include <QJsonValue>
 #include <QLatin1StringView>
-#include <QPair>
+#include <QMetaObject>
+#include <QPointer>
+#include <QScopeGuard>
+#include <QStandardPaths>
+#include <QTcpSocket>
 #include <QVariant>
 #include <Qt>
 #include <QtCborCommon>
 #include <QtGlobal>
 #include <QtLogging>
 
+#include <cerrno>
 #include <cstdint>
 #include <iostream>
 #include <optional>
@@ -37,11 +51,19 @@
 #include <type_traits>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 #if QT_VERSION >= QT_VERSION_CHECK(6, 8, 0)
 #   include <QTcpServer>
 #endif
 
+#ifdef Q_OS_WINDOWS
+#   include <winsock2.h>
+#else
+#   include <poll.h>
+#   include <sys/socket.h>
+#endif
+
 using namespace std::string_literals;
 using namespace Qt::Literals::StringLiterals;
 
@@ -124,6 +146,7 @@ public:
     float temperature = 1.f;
     float top_p = 1.f;
     float min_p = 0.f;
+    std::optional<double> timeout; // seconds; not part of the OpenAI API
 
     BaseCompletionRequest() = default;
     virtual ~BaseCompletionRequest() = default;
@@ -192,6 +215,10 @@ protected:
         if (!value.isNull())
             this->min_p = float(value.toDouble());
 
+        value = reqValue("timeout", Number, false, /*min*/ 0);
+        if (!value.isNull())
+            this->timeout = value.toDouble();
+
         reqValue("user", String); // validate but don't use
     }
 
@@ -436,6 +463,8 @@ Server::Server(Chat *chat)
     connect(chat, &Chat::collectionListChanged, this, &Server::handleCollectionListChanged, Qt::QueuedConnection);
 }
 
+Server::~Server() = default;
+
 static QJsonObject requestFromJson(const QByteArray &request)
 {
     QJsonParseError err;
@@ -515,6 +544,8 @@ void Server::start()
             if (!MySettings::globalInstance()->serverChat())
                 return QHttpServerResponse(QHttpServerResponder::StatusCode::Unauthorized);
 
+            Metrics::globalInstance()->recordRequest();
+
             try {
                 auto reqObj = requestFromJson(request.body());
 #if defined(DEBUG)
@@ -522,6 +553,8 @@ void Server::start()
 #endif
                 CompletionRequest req;
                 parseRequest(req, std::move(reqObj));
+                watchRequest(request, req.timeout);
+                auto unwatch = qScopeGuard([this] { unwatchRequest(); });
                 auto [resp, respObj] = handleCompletionRequest(req);
 #if defined(DEBUG)
                 if (respObj)
@@ -539,6 +572,8 @@ void Server::start()
             if (!MySettings::globalInstance()->serverChat())
                 return QHttpServerResponse(QHttpServerResponder::StatusCode::Unauthorized);
 
+            Metrics::globalInstance()->recordRequest();
+
             try {
                 auto reqObj = requestFromJson(request.body());
 #if defined(DEBUG)
@@ -546,6 +581,8 @@ void Server::start()
 #endif
                 ChatRequest req;
                 parseRequest(req, std::move(reqObj));
+                watchRequest(request, req.timeout);
+                auto unwatch = qScopeGuard([this] { unwatchRequest(); });
                 auto [resp, respObj] = handleChatRequest(req);
                 (void)respObj;
 #if defined(DEBUG)
@@ -559,6 +596,15 @@ void Server::start()
         }
     );
 
+    m_server->route("/metrics", QHttpServerRequest::Method::Get,
+        [] {
+            if (!MySettings::globalInstance()->serverChat())
+                return QHttpServerResponse(QHttpServerResponder::StatusCode::Unauthorized);
+            return QHttpServerResponse("text/plain; version=0.0.4; charset=utf-8"_ba,
+                                       Metrics::globalInstance()->toPrometheus());
+        }
+    );
+
     // Respond with code 405 to wrong HTTP methods:
     m_server->route("/v1/models",  QHttpServerRequest::Method::Post,
         [] {
@@ -629,11 +675,211 @@ static auto makeError(auto &&...args) -> std::pair<QHttpServerResponse, std::opt
     return {QHttpServerResponse(args...), std::nullopt};
 }
 
+// Whether the client has closed its end of the connection. The socket is polled directly, because the event loop of
+// this thread, which would otherwise notice, is blocked while a response is generated.
+static bool peerHasClosed(qintptr fd)
+{
+    if (fd == -1)
+        return true;
+#ifdef Q_OS_WINDOWS
+    WSAPOLLFD pfd { SOCKET(fd), POLLRDNORM, 0 };
+    if (WSAPoll(&pfd, 1, 0) <= 0)
+        return false;
+#else
+    pollfd pfd { int(fd), POLLIN, 0 };
+    if (poll(&pfd, 1, 0) <= 0)
+        return false;
+#endif
+    if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+        return true;
+
+    // readable: either the start of a pipelined request, or the end of the stream
+    char c;
+#ifdef Q_OS_WINDOWS
+    int n = recv(SOCKET(fd), &c, 1, MSG_PEEK);
+    if (n >= 0)
+        return n == 0;
+    // anything else, such as WSAEWOULDBLOCK or WSAEINTR, does not mean the connection is gone
+    switch (WSAGetLastError()) {
+    case WSAECONNRESET:
+    case WSAECONNABORTED:
+    case WSAENETRESET:
+    case WSAENOTCONN:
+    case WSAESHUTDOWN:
+    case WSAETIMEDOUT:
+        return true;
+    default:
+        return false;
+    }
+#else
+    ssize_t n = recv(int(fd), &c, 1, MSG_PEEK);
+    if (n >= 0)
+        return n == 0;
+    // anything else, such as EAGAIN or EINTR, does not mean the connection is gone
+    switch (errno) {
+    case ECONNRESET:
+    case ECONNABORTED:
+    case ENETRESET:
+    case ENOTCONN:
+    case EPIPE:
+    case ETIMEDOUT:
+        return true;
+    default:
+        return false;
+    }
+#endif
+}
+
+void Server::watchRequest(const QHttpServerRequest &request, std::optional<double> timeout)
+{
+    m_cancelReason = CancelReason::None;
+    m_requestDeadline = timeout ? QDeadlineTimer(qint64(*timeout * 1000)) : QDeadlineTimer(QDeadlineTimer::Forever);
+    m_socketCheckTimer.invalidate();
+
+    m_requestSocket = nullptr;
+    const auto sockets = m_server->findChildren<QTcpSocket *>();
+    for (auto *socket : sockets) {
+        if (socket->peerPort() == request.remotePort() && socket->peerAddress() == request.remoteAddress()) {
+            m_requestSocket = socket;
+            break;
+        }
+    }
+}
+
+bool Server::shouldStopGenerating()
+{
+    if (ChatLLM::shouldStopGenerating())
+        return true;
+
+    if (m_requestDeadline.hasExpired()) {
+        m_cancelReason = CancelReason::TimedOut;
+    } else if (m_requestSocket && (!m_socketCheckTimer.isValid() || m_socketCheckTimer.elapsed() >= 100)) {
+        // polling costs a system call, so don't do it for every token
+        m_socketCheckTimer.start();
+        if (peerHasClosed(m_requestSocket->socketDescriptor()))
+            m_cancelReason = CancelReason::Disconnected;
+    }
+    if (m_cancelReason == CancelReason::None)
+        return false;
+
+    stopGenerating();
+    return true;
+}
+
+void Server::unwatchRequest()
+{
+    m_requestSocket.clear();
+    m_requestDeadline = QDeadlineTimer(QDeadlineTimer::Forever);
+    m_cancelReason = CancelReason::None;
+}
+
+auto Server::cancelledResponse() -> std::pair<QHttpServerResponse, std::optional<QJsonObject>>
+{
+    if (m_cancelReason == CancelReason::Disconnected) {
+        std::cerr << "WARNING: client disconnected, stopped generating" << std::endl;
+        // nobody is left to read a body; 499 is the status nginx uses for this, which Qt has no name for
+        return makeError(QHttpServerResponder::StatusCode(499));
+    }
+
+    std::cerr << "WARNING: request timed out, stopped generating" << std::endl;
+    QJsonObject error {
+        { "message", u"the request did not finish within its timeout"_s },
+        { "type",    u"timeout_error"_s                                 },
+        { "param",   QJsonValue::Null                                   },
+        { "code",    QJsonValue::Null                                   },
+    };
+    return makeError(QJsonObject {{ "error", error }}, QHttpServerResponder::StatusCode::GatewayTimeout);
+}
+
+// Identifies a greedy generation: the request, plus everything else that determines the output. Models from the
+// official list carry a checksum; for others, the path, size and modification time of the file stand in for it.
+static QByteArray responseCacheKey(QCborMap request, const ModelInfo &modelInfo, const LLModel::PromptContext &ctx)
+{
+    auto *mySettings = MySettings::globalInstance();
+
+    QByteArray modelId = modelInfo.hash;
+    if (modelId.isEmpty()) {
+        QFileInfo file(modelInfo.dirpath + modelInfo.filename());
+        modelId = u"%1:%2:%3"_s.arg(file.absoluteFilePath()).arg(file.size())
+                      .arg(file.lastModified().toMSecsSinceEpoch()).toUtf8();
+    }
+
+    request.insert(u"generation"_s, QCborMap {
+        { u"app_version"_s,    QCoreApplication::applicationVersion()   },
+        { u"model"_s,          modelId                                  },
+        { u"device"_s,         mySettings->device()                     },
+        { u"n_ctx"_s,          mySettings->modelContextLength(modelInfo) },
+        { u"ngl"_s,            mySettings->modelGpuLayers(modelInfo)     },
+        { u"n_predict"_s,      ctx.n_predict                            },
+        { u"top_k"_s,          ctx.top_k                                },
+        { u"top_p"_s,          ctx.top_p                                },
+        { u"min_p"_s,          ctx.min_p                                },
+        { u"temp"_s,           ctx.temp                                 },
+        { u"n_batch"_s,        ctx.n_batch                              },
+        { u"repeat_penalty"_s, ctx.repeat_penalty                       },
+        { u"repeat_last_n"_s,  ctx.repeat_last_n                        },
+        { u"contextErase"_s,   ctx.contextErase                         },
+    });
+    return QCryptographicHash::hash(request.toCborValue().toCbor(), QCryptographicHash::Sha256);
+}
+
+// Returns the cache only if it is enabled, applying the current size limit.
+ResponseCache *Server::responseCache()
+{
+    auto *mySettings = MySettings::globalInstance();
+    if (!mySettings->serverResponseCache())
+        return nullptr;
+
+    if (!m_responseCache) {
+        auto dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + u"/responses"_s;
+        m_responseCache = std::make_unique<ResponseCache>(dir);
+    }
+    m_responseCache->setMaxBytes(qint64(mySettings->serverResponseCacheSize()) * 1024 * 1024);
+    return m_responseCache.get();
+}
+
+std::optional<QJsonObject> Server::findCachedResponse(ResponseCache *cache, const QByteArray &key)
+{
+    auto responseObject = cache->find(key);
+    Metrics::globalInstance()->recordResponseCacheLookup(bool(responseObject));
+    if (responseObject)
+        responseObject->insert("created", QDateTime::currentSecsSinceEpoch());
+    return responseObject;
+}
+
+static void insertCachedResponse(ResponseCache *cache, const QByteArray &key, QJsonObject responseObject)
+{
+    responseObject.remove("created");
+    cache->insert(key, responseObject);
+}
+
+// Copies a finished exchange into the server chat so that it is visible in the GUI. This happens once per request
+// and is queued to the thread that owns the ChatModel, so the GUI never holds up generation.
+void Server::mirrorToChat(std::vector<MessageInput> history, const QString &response, const QList<ResultInfo> &sources,
+                          bool isError)
+{
+    if (!MySettings::globalInstance()->serverMirrorChat() || !m_chatModel)
+        return;
+
+    QPointer<ChatModel> chatModel = m_chatModel;
+    QMetaObject::invokeMethod(chatModel, [=, history = std::move(history)] {
+        if (!chatModel)
+            return;
+        if (qsizetype count = chatModel->count())
+            chatModel->updateCurrentResponse(count - 1, false);
+        qsizetype startIndex = chatModel->appendResponseWithHistory(history);
+        if (!sources.isEmpty() && history.back().type == MessageInput::Type::Prompt)
+            chatModel->updateSources(startIndex + qsizetype(history.size()) - 1, sources);
+        chatModel->setResponseValue(response);
+        if (isError)
+            chatModel->setError();
+        chatModel->updateCurrentResponse(chatModel->count() - 1, false);
+    }, Qt::QueuedConnection);
+}
+
 auto Server::handleCompletionRequest(const CompletionRequest &request)
     -> std::pair<QHttpServerResponse, std::optional<QJsonObject>>
 {
-    Q_ASSERT(m_chatModel);
-
     auto *mySettings = MySettings::globalInstance();
 
     ModelInfo modelInfo = ModelList::globalInstance()->defaultModelInfo();
@@ -656,21 +902,6 @@ auto Server::handleCompletionRequest(const CompletionRequest &request)
         return makeError(QHttpServerResponder::StatusCode::InternalServerError);
     }
 
-    emit requestResetResponseState(); // blocks
-    qsizetype prevMsgIndex = m_chatModel->count() - 1;
-    if (prevMsgIndex >= 0)
-        m_chatModel->updateCurrentResponse(prevMsgIndex, false);
-
-    // NB: this resets the context, regardless of whether this model is already loaded
-    if (!loadModel(modelInfo)) {
-        std::cerr << "ERROR: couldn't load model " << modelInfo.name().toStdString() << std::endl;
-        return makeError(QHttpServerResponder::StatusCode::InternalServerError);
-    }
-
-    // add prompt/response items to GUI
-    m_chatModel->appendPrompt(request.prompt);
-    m_chatModel->appendResponse();
-
     // FIXME(jared): taking parameters from the UI inhibits reproducibility of results
     LLModel::PromptContext promptCtx {
         .n_predict      = request.max_tokens,
@@ -683,6 +914,31 @@ auto Server::handleCompletionRequest(const CompletionRequest &request)
         .repeat_last_n  = mySettings->modelRepeatPenaltyTokens(modelInfo),
     };
 
+    // with greedy sampling the response only depends on the request, so repeats are answered without the model
+    ResponseCache *cache = request.temperature == 0 ? responseCache() : nullptr;
+    QByteArray cacheKey;
+    if (cache) {
+        cacheKey = responseCacheKey({
+            { u"endpoint"_s, u"completions"_s },
+            { u"prompt"_s,   request.prompt   },
+            { u"n"_s,        request.n        },
+            { u"echo"_s,     request.echo     },
+        }, modelInfo, promptCtx);
+        if (auto responseObject = findCachedResponse(cache, cacheKey)) {
+            auto choice = responseObject->value("choices").toArray().first().toObject();
+            mirrorToChat({{ MessageInput::Type::Prompt, request.prompt }}, choice.value("text").toString().trimmed());
+            return {QHttpServerResponse(*responseObject), *responseObject};
+        }
+    }
+
+    emit requestResetResponseState(); // blocks
+
+    // NB: this resets the context, regardless of whether this model is already loaded
+    if (!loadModel(modelInfo)) {
+        std::cerr << "ERROR: couldn't load model " << modelInfo.name().toStdString() << std::endl;
+        return makeError(QHttpServerResponder::StatusCode::InternalServerError);
+    }
+
     auto promptUtf8 = request.prompt.toUtf8();
     int promptTokens = 0;
     int responseTokens = 0;
@@ -692,13 +948,17 @@ auto Server::handleCompletionRequest(const CompletionRequest &request)
         try {
             result = promptInternal(std::string_view(promptUtf8.cbegin(), promptUtf8.cend()),
                                     promptCtx,
-                                    /*usedLocalDocs*/ false);
+                                    /*usedLocalDocs*/ false,
+                                    /*updateChatModel*/ false);
         } catch (const std::exception &e) {
-            m_chatModel->setResponseValue(e.what());
-            m_chatModel->setError();
+            mirrorToChat({{ MessageInput::Type::Prompt, request.prompt }}, e.what(), {}, /*isError*/ true);
             emit responseStopped(0);
             return makeError(QHttpServerResponder::StatusCode::InternalServerError);
         }
+        if (m_cancelReason != CancelReason::None) {
+            mirrorToChat({{ MessageInput::Type::Prompt, request.prompt }}, tr("Request cancelled"), {}, /*isError*/ true);
+            return cancelledResponse();
+        }
         QString resp = QString::fromUtf8(result.response);
         if (request.echo)
             resp = request.prompt + resp;
@@ -708,6 +968,8 @@ auto Server::handleCompletionRequest(const CompletionRequest &request)
         responseTokens += result.responseTokens;
     }
 
+    mirrorToChat({{ MessageInput::Type::Prompt, request.prompt }}, responses.constFirst().trimmed());
+
     QJsonObject responseObject {
         { "id",      "placeholder"                      },
         { "object",  "text_completion"                  },
@@ -732,6 +994,9 @@ auto Server::handleCompletionRequest(const CompletionRequest &request)
         { "total_tokens",      promptTokens + responseTokens },
     });
 
+    if (cache)
+        insertCachedResponse(cache, cacheKey, responseObject);
+
     return {QHttpServerResponse(responseObject), responseObject};
 }
 
@@ -760,6 +1025,61 @@ auto Server::handleChatRequest(const ChatRequest &request)
         return makeError(QHttpServerResponder::StatusCode::InternalServerError);
     }
 
+    Q_ASSERT(!request.messages.isEmpty());
+
+    // FIXME(jared): taking parameters from the UI inhibits reproducibility of results
+    LLModel::PromptContext promptCtx {
+        .n_predict      = request.max_tokens,
+        .top_k          = mySettings->modelTopK(modelInfo),
+        .top_p          = request.top_p,
+        .min_p          = request.min_p,
+        .temp           = request.temperature,
+        .n_batch        = mySettings->modelPromptBatchSize(modelInfo),
+        .repeat_penalty = float(mySettings->modelRepeatPenalty(modelInfo)),
+        .repeat_last_n  = mySettings->modelRepeatPenaltyTokens(modelInfo),
+    };
+
+    // LocalDocs sources change as collections are updated, so responses that use them are never cached
+    ResponseCache *cache = request.temperature == 0 && m_collections.isEmpty() ? responseCache() : nullptr;
+    QByteArray cacheKey;
+    if (cache) {
+        // the rendered prompt is a function of the chat template, the system message, the messages and the tools,
+        // whose descriptions are translated
+        QString chatTemplate = mySettings->modelChatTemplate(modelInfo).asModern().value_or(QString());
+        QCborArray messages;
+        for (auto &message : request.messages)
+            messages << QCborArray { int(message.role), message.content };
+        QString systemMessage = mySettings->modelSystemMessage(modelInfo).asModern().value_or(QString());
+        auto toolList = json(ToolModel::globalInstance()->jinjaToolList()).dump();
+        QCborMap key {
+            { u"endpoint"_s,       u"chat/completions"_s                 },
+            { u"chat_template"_s,  chatTemplate                          },
+            { u"system_message"_s, systemMessage                         },
+            { u"messages"_s,       messages                              },
+            { u"tool_list"_s,      QString::fromStdString(toolList)      },
+            { u"n"_s,              request.n                             },
+            { u"references"_s,     mySettings->localDocsShowReferences() },
+        };
+        // templates may include the current date
+        if (chatTemplate.contains("strftime_now"_L1))
+            key.insert(u"date"_s, QDate::currentDate().toString(Qt::ISODate));
+        cacheKey = responseCacheKey(std::move(key), modelInfo, promptCtx);
+        if (auto responseObject = findCachedResponse(cache, cacheKey)) {
+            std::vector<MessageInput> history;
+            for (auto &message : request.messages) {
+                using enum ChatRequest::Message::Role;
+                switch (message.role) {
+                    case System:    history.push_back({ MessageInput::Type::System,   message.content }); break;
+                    case User:      history.push_back({ MessageInput::Type::Prompt,   message.content }); break;
+                    case Assistant: history.push_back({ MessageInput::Type::Response, message.content }); break;
+                }
+            }
+            auto choice = responseObject->value("choices").toArray().first().toObject();
+            mirrorToChat(std::move(history), choice.value("message").toObject().value("content").toString().trimmed());
+            return {QHttpServerResponse(*responseObject), *responseObject};
+        }
+    }
+
     emit requestResetResponseState(); // blocks
 
     // NB: this resets the context, regardless of whether this model is already loaded
@@ -768,12 +1088,11 @@ auto Server::handleChatRequest(const ChatRequest &request)
         return makeError(QHttpServerResponder::StatusCode::InternalServerError);
     }
 
-    m_chatModel->updateCurrentResponse(m_chatModel->count() - 1, false);
-
-    Q_ASSERT(!request.messages.isEmpty());
-
-    // adds prompt/response items to GUI
+    // the conversation is built directly from the request and never goes through the ChatModel
     std::vector<MessageInput> messages;
+    std::vector<MessageItem>  messageItems;
+    messages.reserve(request.messages.size());
+    messageItems.reserve(request.messages.size());
     for (auto &message : request.messages) {
         using enum ChatRequest::Message::Role;
         switch (message.role) {
@@ -781,40 +1100,48 @@ auto Server::handleChatRequest(const ChatRequest &request)
             case User:      messages.push_back({ MessageInput::Type::Prompt,   message.content }); break;
             case Assistant: messages.push_back({ MessageInput::Type::Response, message.content }); break;
         }
+        switch (message.role) {
+            case System:    messageItems.emplace_back(MessageItem::Type::System,   message.content); break;
+            case User:      messageItems.emplace_back(MessageItem::Type::Prompt,   message.content); break;
+            case Assistant: messageItems.emplace_back(MessageItem::Type::Response, message.content); break;
+        }
     }
-    auto startOffset = m_chatModel->appendResponseWithHistory(messages);
 
-    // FIXME(jared): taking parameters from the UI inhibits reproducibility of results
-    LLModel::PromptContext promptCtx {
-        .n_predict      = request.max_tokens,
-        .top_k          = mySettings->modelTopK(modelInfo),
-        .top_p          = request.top_p,
-        .min_p          = request.min_p,
-        .temp           = request.temperature,
-        .n_batch        = mySettings->modelPromptBatchSize(modelInfo),
-        .repeat_penalty = float(mySettings->modelRepeatPenalty(modelInfo)),
-        .repeat_last_n  = mySettings->modelRepeatPenaltyTokens(modelInfo),
-    };
+    // the final user message, if any, is the LocalDocs query
+    QList<ResultInfo> databaseResults;
+    if (!m_collections.isEmpty() && messageItems.back().type() == MessageItem::Type::Prompt) {
+        const QString query = messageItems.back().content();
+        const int retrievalSize = mySettings->localDocsRetrievalSize();
+        emit requestRetrieveFromDB(m_collections, query, retrievalSize, &databaseResults); // blocks
+        messageItems.back() = MessageItem(MessageItem::Type::Prompt, query, databaseResults, {});
+        emit databaseResultsChanged(databaseResults);
+    }
 
     int promptTokens   = 0;
     int responseTokens = 0;
-    QList<QPair<QString, QList<ResultInfo>>> responses;
+    QStringList responses;
     for (int i = 0; i < request.n; ++i) {
-        ChatPromptResult result;
+        PromptResult result;
         try {
-            result = promptInternalChat(m_collections, promptCtx, startOffset);
+            result = promptInternal(messageItems, promptCtx, /*usedLocalDocs*/ !databaseResults.isEmpty(),
+                                    /*updateChatModel*/ false);
         } catch (const std::exception &e) {
-            m_chatModel->setResponseValue(e.what());
-            m_chatModel->setError();
+            mirrorToChat(std::move(messages), e.what(), databaseResults, /*isError*/ true);
             emit responseStopped(0);
             return makeError(QHttpServerResponder::StatusCode::InternalServerError);
         }
-        responses.emplace_back(result.response, result.databaseResults);
+        if (m_cancelReason != CancelReason::None) {
+            mirrorToChat(std::move(messages), tr("Request cancelled"), databaseResults, /*isError*/ true);
+            return cancelledResponse();
+        }
+        responses << QString::fromUtf8(result.response);
         if (i == 0)
             promptTokens = result.promptTokens;
         responseTokens += result.responseTokens;
     }
 
+    mirrorToChat(std::move(messages), responses.constFirst().trimmed(), databaseResults);
+
     QJsonObject responseObject {
         { "id",      "placeholder"                      },
         { "object",  "chat.completion"                  },
@@ -825,9 +1152,7 @@ auto Server::handleChatRequest(const ChatRequest &request)
     QJsonArray choices;
     {
         int index = 0;
-        for (const auto &r : responses) {
-            QString result = r.first;
-            QList<ResultInfo> infos = r.second;
+        for (const auto &result : std::as_const(responses)) {
             QJsonObject message {
                 { "role",    "assistant" },
                 { "content", result      },
@@ -840,7 +1165,7 @@ auto Server::handleChatRequest(const ChatRequest &request)
             };
             if (MySettings::globalInstance()->localDocsShowReferences()) {
                 QJsonArray references;
-                for (const auto &ref : infos)
+                for (const auto &ref : std::as_const(databaseResults))
                     references.append(resultToJson(ref));
                 choice.insert("references", references.isEmpty() ? QJsonValue::Null : QJsonValue(references));
             }
@@ -855,5 +1180,8 @@ auto Server::handleChatRequest(const ChatRequest &request)
         { "total_tokens",      promptTokens + responseTokens },
     });
 
+    if (cache)
+        insertCachedResponse(cache, cacheKey, responseObject);
+
     return {QHttpServerResponse(responseObject), responseObject};
 }
@@ -4,20 +4,28 @@
 #include "chatllm.h"
 #include "database.h"
 
+#include <QByteArray>
+#include <QDeadlineTimer>
+#include <QElapsedTimer>
 #include <QHttpServer>
+#include <QHttpServerRequest>
 #include <QHttpServerResponse>
 #include <QJsonObject>
 #include <QList>
 #include <QObject>
+#include <QPointer>
 #include <QString>
+#include <QTcpSocket>
 
 #include <memory>
 #include <optional>
 #include <utility>
+#include <vector>
 
 class Chat;
 class ChatRequest;
 class CompletionRequest;
+class ResponseCache;
 
 
 class Server : public ChatLLM
@@ -26,7 +34,7 @@ class Server : public ChatLLM
 
 public:
     explicit Server(Chat *chat);
-    ~Server() override = default;
+    ~Server() override;
 
 public Q_SLOTS:
     void start();
@@ -34,9 +42,21 @@ public Q_SLOTS:
 Q_SIGNALS:
     void requestResetResponseState();
 
+protected:
+    bool shouldStopGenerating() override;
+
 private:
+    enum class CancelReason { None, Disconnected, TimedOut };
+
+    void watchRequest(const QHttpServerRequest &request, std::optional<double> timeout);
+    void unwatchRequest();
+    auto cancelledResponse() -> std::pair<QHttpServerResponse, std::optional<QJsonObject>>;
     auto handleCompletionRequest(const CompletionRequest &request) -> std::pair<QHttpServerResponse, std::optional<QJsonObject>>;
     auto handleChatRequest(const ChatRequest &request) -> std::pair<QHttpServerResponse, std::optional<QJsonObject>>;
+    void mirrorToChat(std::vector<MessageInput> history, const QString &response,
+                      const QList<ResultInfo> &sources = {}, bool isError = false);
+    ResponseCache *responseCache();
+    std::optional<QJsonObject> findCachedResponse(ResponseCache *cache, const QByteArray &key);
 
 private Q_SLOTS:
     void handleDatabaseResultsChanged(const QList<ResultInfo> &results) { m_databaseResults = results; }
@@ -45,6 +65,13 @@ private Q_SLOTS:
 private:
     Chat *m_chat;
     std::unique_ptr<QHttpServer> m_server;
+    std::unique_ptr<ResponseCache> m_responseCache;
+
+    // the request being generated, for cancellation
+    QPointer<QTcpSocket> m_requestSocket;
+    QDeadlineTimer m_requestDeadline { QDeadlineTimer::Forever };
+    QElapsedTimer m_socketCheckTimer;
+    CancelReason m_cancelReason = CancelReason::None;
     QList<ResultInfo> m_databaseResults;
     QList<QString> m_collections;
 };
@@ -0,0 +1,112 @@
+#include "chat.h"
+#include "chatllm.h"
+#include "config.h"
+#include "logger.h"
+#include "modellist.h"
+#include "mysettings.h"
+
+#include <gpt4all-backend/llmodel.h>
+
+#include <QCommandLineOption>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QObject>
+#include <QSettings>
+#include <QString>
+#include <QStringList>
+#include <Qt>
+
+#include <cstdio>
+
+#ifndef GPT4ALL_USE_QTPDF
+#   include <fpdfview.h>
+#endif
+
+#ifndef Q_OS_WINDOWS
+#   include <signal.h>
+#endif
+
+using namespace Qt::Literals::StringLiterals;
+
+
+// Entry point of gpt4all-server: runs the OpenAI-compatible API server without any QML or GUI.
+// Models, settings and LocalDocs collections are shared with the desktop application.
+int main(int argc, char *argv[])
+{
+#ifndef GPT4ALL_USE_QTPDF
+    FPDF_InitLibrary();
+#endif
+
+    QCoreApplication::setOrganizationName("nomic.ai");
+    QCoreApplication::setOrganizationDomain("gpt4all.io");
+    QCoreApplication::setApplicationName("GPT4All");
+    QCoreApplication::setApplicationVersion(APP_VERSION);
+    QSettings::setDefaultFormat(QSettings::IniFormat);
+
+    Logger::globalInstance();
+
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(u"GPT4All headless API server"_s);
+    parser.addHelpOption();
+    parser.addVersionOption();
+    QCommandLineOption portOption(u"port"_s, u"Port to listen on (default: the API Server Port setting)."_s,
+                                  u"port"_s);
+    parser.addOption(portOption);
+    parser.process(app);
+
+    // set search path before constructing the MySettings instance, which relies on this
+    {
+        auto appDirPath = QCoreApplication::applicationDirPath();
+        QStringList searchPaths {
+#ifdef Q_OS_DARWIN
+            u"%1/../Frameworks"_s.arg(appDirPath),
+#else
+            appDirPath,
+            u"%1/../lib"_s.arg(appDirPath),
+#endif
+        };
+        LLModel::Implementation::setImplementationsSearchPath(searchPaths.join(u';').toStdString());
+    }
+
+    // The server is the only thing this process does, so it is always enabled. None of these overrides are written
+    // back to the settings file shared with the desktop application.
+    auto *mySettings = MySettings::globalInstance();
+    mySettings->overrideBasicSetting(u"serverChat"_s, true);
+    mySettings->overrideBasicSetting(u"server/mirrorChat"_s, false);
+    if (parser.isSet(portOption)) {
+        bool ok;
+        int port = parser.value(portOption).toInt(&ok);
+        if (!ok || port <= 0 || port > 65535) {
+            std::fprintf(stderr, "invalid port: %s\n", qPrintable(parser.value(portOption)));
+            return 1;
+        }
+        mySettings->overrideBasicSetting(u"networkPort"_s, port);
+    }
+
+    auto *modelList = ModelList::globalInstance();
+    QObject::connect(modelList, &ModelList::dataChanged, mySettings, &MySettings::onModelInfoChanged);
+
+    // the server starts listening once the ChatLLM thread of this chat has started
+    auto *chat = new Chat(Chat::server_tag, &app);
+
+#ifndef Q_OS_WINDOWS
+    // handle signals gracefully
+    struct sigaction sa;
+    sa.sa_handler = [](int s) { QCoreApplication::exit(s == SIGINT ? 0 : 1); };
+    sa.sa_flags   = SA_RESETHAND;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT,  &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+    sigaction(SIGHUP,  &sa, nullptr);
+#endif
+
+    int res = app.exec();
+
+    // Make sure the ChatLLM thread is joined before global destructors run.
+    chat->destroy();
+    ChatLLM::destroyStore();
+
+    return res;
+}
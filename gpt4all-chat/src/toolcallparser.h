@@ -36,6 +36,7 @@ public:
     bool splitIfPossible();
     QStringList buffers() const;
     int numberOfBuffers() const { return m_buffers.size(); }
+    const QByteArray &lastBuffer() const { return m_buffers.last(); }
 
 private:
     QByteArray &currentBuffer();
@@ -5,6 +5,9 @@
 #include <QCoreApplication>
 #include <QEvent>
 #include <QGlobalStatic>
+#include <QMutexLocker>
+
+#include <utility>
 
 class MyToolModel: public ToolModel { };
 Q_GLOBAL_STATIC(MyToolModel, toolModelInstance)
@@ -25,7 +28,25 @@ ToolModel::ToolModel()
 
 bool ToolModel::eventFilter(QObject *obj, QEvent *ev)
 {
-    if (obj == QCoreApplication::instance() && ev->type() == QEvent::LanguageChange)
+    if (obj == QCoreApplication::instance() && ev->type() == QEvent::LanguageChange) {
+        {
+            QMutexLocker locker(&m_jinjaToolListMutex);
+            m_jinjaToolList.reset(); // the descriptions are translated
+        }
         emit dataChanged(index(0, 0), index(m_tools.size() - 1, 0));
+    }
     return false;
 }
+
+json::array_t ToolModel::jinjaToolList() const
+{
+    QMutexLocker locker(&m_jinjaToolListMutex);
+    if (!m_jinjaToolList) {
+        json::array_t toolList;
+        toolList.reserve(m_tools.size());
+        for (const Tool *t : m_tools)
+            toolList.push_back(t->jinjaValue());
+        m_jinjaToolList = std::move(toolList);
+    }
+    return *m_jinjaToolList;
+}
@@ -7,10 +7,13 @@
 #include <QByteArray>
 #include <QHash>
 #include <QList>
+#include <QMutex>
 #include <QString>
 #include <QVariant>
 #include <QtGlobal>
 
+#include <optional>
+
 class ToolModel : public QAbstractListModel
 {
     Q_OBJECT
@@ -92,6 +95,9 @@ public:
 
     int count() const { return m_tools.size(); }
 
+    // The tools as passed to chat templates. Built once and rebuilt when the language changes.
+    json::array_t jinjaToolList() const;
+
 Q_SIGNALS:
     void countChanged();
     void valueChanged(int index, const QString &value);
@@ -105,6 +111,8 @@ private:
     friend class MyToolModel;
     QList<Tool*> m_tools;
     QHash<QString, Tool*> m_toolMap;
+    mutable QMutex m_jinjaToolListMutex;
+    mutable std::optional<json::array_t> m_jinjaToolList;
 };
 
 #endif // TOOLMODEL_H
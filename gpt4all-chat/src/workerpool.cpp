@@ -0,0 +1,76 @@
+#include "workerpool.h"
+
+#include "mysettings.h"
+
+#include <QGlobalStatic>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+
+class MyWorkerPool: public WorkerPool { };
+Q_GLOBAL_STATIC(MyWorkerPool, workerPoolInstance)
+WorkerPool *WorkerPool::globalInstance()
+{
+    return workerPoolInstance();
+}
+
+WorkerPool::WorkerPool()
+{
+    int nThreads = MySettings::globalInstance()->workerThreads();
+    setMaxThreadCount(nThreads > 0 ? nThreads : QThread::idealThreadCount());
+    setExpiryTimeout(-1);
+    setObjectName("workers");
+}
+
+void WorkerPool::parallelFor(qsizetype count, qsizetype grainSize, const std::function<void(qsizetype, qsizetype)> &fn)
+{
+    if (count <= 0)
+        return;
+    grainSize = std::max<qsizetype>(grainSize, 1);
+
+    // Shared with the pool tasks, which may start after this call has returned and must then find nothing to do.
+    struct State {
+        std::function<void(qsizetype, qsizetype)> fn;
+        qsizetype                                  count;
+        qsizetype                                  grainSize;
+        std::atomic<qsizetype>                     next = 0;
+        std::atomic<qsizetype>                     done = 0;
+        QMutex                                     mutex;
+        QWaitCondition                             finished;
+    };
+    auto state = std::make_shared<State>();
+    state->fn        = fn;
+    state->count     = count;
+    state->grainSize = grainSize;
+
+    auto run = [state] {
+        for (;;) {
+            qsizetype begin = state->next.fetch_add(state->grainSize);
+            if (begin >= state->count)
+                return;
+            qsizetype end = std::min(begin + state->grainSize, state->count);
+            state->fn(begin, end);
+            if (state->done.fetch_add(end - begin) + (end - begin) == state->count) {
+                QMutexLocker locker(&state->mutex);
+                state->finished.wakeAll();
+            }
+        }
+    };
+
+    // The calling thread works too, so this makes progress even if every worker is busy.
+    qsizetype nRanges = (count + grainSize - 1) / grainSize;
+    qsizetype nHelpers = std::min<qsizetype>(nRanges - 1, maxThreadCount());
+    for (qsizetype i = 0; i < nHelpers; i++)
+        start(run);
+    run();
+
+    QMutexLocker locker(&state->mutex);
+    while (state->done < state->count)
+        state->finished.wait(&state->mutex);
+}
@@ -0,0 +1,27 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <QThreadPool>
+#include <QtGlobal>
+
+#include <functional>
+
+// Process-wide pool of worker threads for CPU-bound LocalDocs work, so that it does not start and join threads for
+// every query. Its size is the "workerThreads" setting, where 0 means one thread per CPU core. Its threads are kept
+// alive while idle.
+class WorkerPool : public QThreadPool
+{
+public:
+    static WorkerPool *globalInstance();
+
+    // Calls fn(begin, end) for consecutive ranges of at most grainSize items covering [0, count), on the pool and the
+    // calling thread, and returns once all of them have finished. Safe to call from a worker thread.
+    void parallelFor(qsizetype count, qsizetype grainSize, const std::function<void(qsizetype, qsizetype)> &fn);
+
+protected:
+    explicit WorkerPool();
+
+    friend class MyWorkerPool;
+};
+
+#endif // WORKERPOOL_H
@@ -0,0 +1,179 @@
+#include "chatjournal.h"
+
+#include <gtest/gtest.h>
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QIODevice>
+#include <QList>
+#include <QString>
+#include <QTemporaryDir>
+
+static constexpr int VERSION = 12;
+
+class ChatJournalTest : public testing::Test {
+protected:
+    void SetUp() override
+    {
+        ASSERT_TRUE(m_dir.isValid());
+        m_chatFile = m_dir.filePath(u"gpt4all-test.chat"_s);
+    }
+
+    // what ChatSaver does when it cannot append: write the whole chat file, remove its journal, and mark it saved
+    void writeChatFile(ChatJournal &journal, const QByteArray &header, const QByteArray &data = "messages")
+    {
+        QFile file(m_chatFile);
+        ASSERT_TRUE(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+        file.write(header + data);
+        file.close();
+        QFile::remove(ChatJournal::path(m_chatFile));
+        journal.reset(VERSION, header);
+    }
+
+    bool append(ChatJournal &journal, const QByteArray &header, const QString &message)
+    {
+        return journal.append(m_chatFile, VERSION, header, [&](QDataStream &out) { out << message; });
+    }
+
+    // what Chat does when it is loaded: read the chat file and its journal, and apply the journal
+    QList<QString> reload(ChatJournal &journal, const QByteArray &header)
+    {
+        QByteArray data;
+        QFile journalFile(ChatJournal::path(m_chatFile));
+        if (journalFile.open(QIODevice::ReadOnly))
+            data = journalFile.readAll();
+
+        QList<QString> messages;
+        const QFileInfo info(m_chatFile);
+        journal.reset(VERSION, header);
+        if (!data.isEmpty()) {
+            journal.apply(m_chatFile, data, info.size(), info.lastModified().toMSecsSinceEpoch(),
+                          [&](QDataStream &in) {
+                QString message;
+                in >> message;
+                messages << message;
+                return in.status() == QDataStream::Ok;
+            });
+        }
+        return messages;
+    }
+
+    qint64 journalFileSize() const { return QFileInfo(ChatJournal::path(m_chatFile)).size(); }
+
+    QTemporaryDir m_dir;
+    QString       m_chatFile;
+};
+
+TEST_F(ChatJournalTest, NothingToAppendToBeforeTheChatFileIsWritten)
+{
+    ChatJournal journal;
+    EXPECT_FALSE(append(journal, "header", u"hello"_s));
+    EXPECT_FALSE(QFile::exists(ChatJournal::path(m_chatFile)));
+}
+
+TEST_F(ChatJournalTest, EditsAreAppendedAndAppliedOnReload)
+{
+    ChatJournal journal;
+    writeChatFile(journal, "header");
+
+    ASSERT_TRUE(append(journal, "header", u"hello"_s));
+    const qint64 sizeAfterFirst = journalFileSize();
+    EXPECT_GT(sizeAfterFirst, 0);
+    EXPECT_EQ(journal.size(), sizeAfterFirst);
+
+    ASSERT_TRUE(append(journal, "header", u"world"_s));
+    EXPECT_GT(journalFileSize(), sizeAfterFirst);
+    EXPECT_EQ(journal.size(), journalFileSize());
+
+    ChatJournal reloaded;
+    EXPECT_EQ(reload(reloaded, "header"), (QList<QString> { u"hello"_s, u"world"_s }));
+
+    // a reloaded chat keeps appending to the same journal
+    ASSERT_TRUE(append(reloaded, "header", u"again"_s));
+    ChatJournal reloadedAgain;
+    EXPECT_EQ(reload(reloadedAgain, "header"), (QList<QString> { u"hello"_s, u"world"_s, u"again"_s }));
+}
+
+TEST_F(ChatJournalTest, FullRewriteClearsTheJournal)
+{
+    ChatJournal journal;
+    writeChatFile(journal, "header");
+    ASSERT_TRUE(append(journal, "header", u"hello"_s));
+
+    // a changed header cannot be appended, so the whole chat file is written
+    EXPECT_FALSE(append(journal, "renamed", u"world"_s));
+    writeChatFile(journal, "renamed");
+    EXPECT_EQ(journal.size(), 0);
+    EXPECT_FALSE(QFile::exists(ChatJournal::path(m_chatFile)));
+
+    ASSERT_TRUE(append(journal, "renamed", u"after"_s));
+    ChatJournal reloaded;
+    EXPECT_EQ(reload(reloaded, "renamed"), QList<QString> { u"after"_s });
+}
+
+TEST_F(ChatJournalTest, LargeJournalIsCompacted)
+{
+    ChatJournal journal;
+    writeChatFile(journal, "header");
+
+    // the journal may not grow larger than the chat file, or 64 KiB for small chats
+    EXPECT_FALSE(append(journal, "header", QString(40 * 1024, u'x')));
+    EXPECT_FALSE(QFile::exists(ChatJournal::path(m_chatFile)));
+    EXPECT_TRUE(append(journal, "header", QString(1024, u'x')));
+}
+
+TEST_F(ChatJournalTest, JournalChangedBySomeoneElseIsNotAppendedTo)
+{
+    ChatJournal journal;
+    writeChatFile(journal, "header");
+    ASSERT_TRUE(append(journal, "header", u"hello"_s));
+
+    QFile journalFile(ChatJournal::path(m_chatFile));
+    ASSERT_TRUE(journalFile.open(QIODevice::WriteOnly | QIODevice::Append));
+    journalFile.write("garbage");
+    journalFile.close();
+
+    EXPECT_FALSE(append(journal, "header", u"world"_s));
+}
+
+TEST_F(ChatJournalTest, StaleJournalIsIgnored)
+{
+    ChatJournal journal;
+    writeChatFile(journal, "header");
+    ASSERT_TRUE(append(journal, "header", u"hello"_s));
+    const QByteArray staleJournal = [&] {
+        QFile file(ChatJournal::path(m_chatFile));
+        return file.open(QIODevice::ReadOnly) ? file.readAll() : QByteArray();
+    }();
+
+    // the chat file was written again, but its journal could not be removed
+    writeChatFile(journal, "header", "more messages");
+    QFile journalFile(ChatJournal::path(m_chatFile));
+    ASSERT_TRUE(journalFile.open(QIODevice::WriteOnly));
+    journalFile.write(staleJournal);
+    journalFile.close();
+
+    ChatJournal reloaded;
+    EXPECT_TRUE(reload(reloaded, "header").isEmpty());
+    // and the next save writes the whole chat file, which replaces it
+    EXPECT_FALSE(append(reloaded, "header", u"world"_s));
+}
+
+TEST_F(ChatJournalTest, IncompleteRecordIsIgnored)
+{
+    ChatJournal journal;
+    writeChatFile(journal, "header");
+    ASSERT_TRUE(append(journal, "header", u"hello"_s));
+    ASSERT_TRUE(append(journal, "header", u"world"_s));
+
+    // cut off in the middle of the last record
+    QFile journalFile(ChatJournal::path(m_chatFile));
+    ASSERT_TRUE(journalFile.resize(journalFileSize() - 2));
+
+    ChatJournal reloaded;
+    EXPECT_EQ(reload(reloaded, "header"), QList<QString> { u"hello"_s });
+    EXPECT_FALSE(append(reloaded, "header", u"again"_s));
+}
@@ -52,7 +52,7 @@ class Requestor:
 request = Requestor()
 
 
-def create_chat_server_config(tmpdir: Path, model_copied: bool = False) -> dict[str, str]:
+def create_chat_server_config(tmpdir: Path, model_copied: bool = False, extra_config: str = '') -> dict[str, str]:
     xdg_confdir = tmpdir / 'config'
     app_confdir = xdg_confdir / 'nomic.ai'
     app_confdir.mkdir(parents=True)
@@ -68,6 +68,7 @@ def create_chat_server_config(tmpdir: Path, model_copied: bool = False) -> dict[
             isActive=false
             usageStatsActive=false
         """))
+        conf.write(textwrap.dedent(extra_config))
 
     if model_copied:
         app_data_dir = tmpdir / 'share' / 'nomic.ai' / 'GPT4All'
@@ -85,13 +86,13 @@ def create_chat_server_config(tmpdir: Path, model_copied: bool = False) -> dict[
 
 
 @contextmanager
-def prepare_chat_server(model_copied: bool = False) -> Iterator[dict[str, str]]:
+def prepare_chat_server(model_copied: bool = False, extra_config: str = '') -> Iterator[dict[str, str]]:
     if os.name != 'posix' or sys.platform == 'darwin':
         pytest.skip('Need non-Apple Unix to use alternate config path')
 
     with tempfile.TemporaryDirectory(prefix='gpt4all-test') as td:
         tmpdir = Path(td)
-        config = create_chat_server_config(tmpdir, model_copied=model_copied)
+        config = create_chat_server_config(tmpdir, model_copied=model_copied, extra_config=extra_config)
         yield config
 
 
@@ -120,6 +121,24 @@ def chat_server_with_model() -> Iterator[None]:
         yield from start_chat_server(config)
 
 
+@pytest.fixture
+def chat_server_with_response_cache() -> Iterator[None]:
+    extra_config = """\
+
+        [server]
+        responseCache=true
+    """
+    with prepare_chat_server(model_copied=True, extra_config=extra_config) as config:
+        yield from start_chat_server(config)
+
+
+def get_metrics() -> dict[str, str]:
+    resp = request.session.get('http://localhost:4891/metrics')
+    resp.raise_for_status()
+    assert resp.headers['Content-Type'].startswith('text/plain')
+    return dict(line.rsplit(' ', 1) for line in resp.text.splitlines() if not line.startswith('#'))
+
+
 def test_with_models_empty(chat_server: None) -> None:
     # non-sense endpoint
     status_code, response = request.get('foobarbaz', wait=True, raise_for_status=False)
@@ -261,3 +280,82 @@ def test_with_models_temperature(chat_server_with_model: None) -> None:
     }
 
     request.post('completions', data=data, wait=True, raise_for_status=True)
+
+
+def test_metrics(chat_server_with_model: None) -> None:
+    data = dict(
+        model       = 'Llama 3.2 1B Instruct',
+        prompt      = 'The quick brown fox',
+        temperature = 0,
+        max_tokens  = 6,
+    )
+    request.post('completions', data=data, wait=True)
+
+    metrics = get_metrics()
+    assert metrics['gpt4all_server_requests_total'] == '1'
+    assert metrics['gpt4all_time_to_first_token_seconds_count'] == '1'
+    assert int(metrics['gpt4all_model_load_seconds_count']) >= 1
+    assert int(metrics['gpt4all_response_tokens_total']) > 0
+
+
+CACHE_HITS   = 'gpt4all_response_cache_lookups_total{result="hit"}'
+CACHE_MISSES = 'gpt4all_response_cache_lookups_total{result="miss"}'
+
+
+def test_response_cache(chat_server_with_response_cache: None) -> None:
+    data = dict(
+        model       = 'Llama 3.2 1B Instruct',
+        prompt      = 'The quick brown fox',
+        temperature = 0,
+        max_tokens  = 6,
+    )
+    first = request.post('completions', data=data, wait=True)
+    second = request.post('completions', data=data)
+    del first['created'], second['created']
+    assert first == second == EXPECTED_COMPLETIONS_RESPONSE
+
+    metrics = get_metrics()
+    assert metrics[CACHE_MISSES] == '1'
+    assert metrics[CACHE_HITS] == '1'
+
+    # sampled responses are never looked up
+    data['temperature'] = 0.5
+    request.post('completions', data=data)
+    request.post('completions', data=data)
+
+    metrics = get_metrics()
+    assert metrics[CACHE_MISSES] == '1'
+    assert metrics[CACHE_HITS] == '1'
+
+
+def test_response_cache_off_by_default(chat_server_with_model: None) -> None:
+    data = dict(
+        model       = 'Llama 3.2 1B Instruct',
+        prompt      = 'The quick brown fox',
+        temperature = 0,
+        max_tokens  = 6,
+    )
+    request.post('completions', data=data, wait=True)
+    request.post('completions', data=data)
+
+    metrics = get_metrics()
+    assert metrics[CACHE_MISSES] == '0'
+    assert metrics[CACHE_HITS] == '0'
+
+
+def test_request_timeout(chat_server_with_model: None) -> None:
+    data = dict(
+        model       = 'Llama 3.2 1B Instruct',
+        prompt      = 'The quick brown fox',
+        temperature = 0,
+        max_tokens  = 6,
+    )
+
+    # a generous timeout does not change the response
+    response = request.post('completions', data=dict(data, timeout=60), wait=True)
+    del response['created']
+    assert response == EXPECTED_COMPLETIONS_RESPONSE
+
+    status_code, response = request.post('completions', data=dict(data, timeout=0.001), raise_for_status=False)
+    assert status_code == 504
+    assert response['error']['type'] == 'timeout_error'